@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../ptedit_header.h"
+
+#define COLOR_RED "\x1b[31m"
+#define COLOR_GREEN "\x1b[32m"
+#define COLOR_YELLOW "\x1b[33m"
+#define COLOR_RESET "\x1b[0m"
+
+#define TAG_OK COLOR_GREEN "[+]" COLOR_RESET " "
+#define TAG_FAIL COLOR_RED "[-]" COLOR_RESET " "
+#define TAG_PROGRESS COLOR_YELLOW "[~]" COLOR_RESET " "
+
+#define LINE 64
+/* Bandwidth kernels work on chunks to bound the runtime for slow types */
+#define CHUNK (64 * 1024)
+
+static const unsigned char types[] = {PTEDIT_MT_UC, PTEDIT_MT_WC, PTEDIT_MT_WT, PTEDIT_MT_WP, PTEDIT_MT_WB, PTEDIT_MT_UCMINUS};
+#define TYPES (sizeof(types) / sizeof(types[0]))
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <emmintrin.h>
+// ---------------------------------------------------------------------------
+static void flush(void* p) { _mm_clflush(p); }
+
+// ---------------------------------------------------------------------------
+static void mfence() { _mm_mfence(); }
+
+// ---------------------------------------------------------------------------
+static void stream_chunk(char* p, size_t length) {
+    __m128i value = _mm_set1_epi32(0x5a5a5a5a);
+    size_t i;
+    for (i = 0; i < length; i += 16) _mm_stream_si128((__m128i*)(p + i), value);
+    _mm_sfence();
+}
+#elif defined(__aarch64__)
+// ---------------------------------------------------------------------------
+static void flush(void* p) {
+    asm volatile("DC CIVAC, %0" ::"r"(p));
+    asm volatile("DSB ISH");
+}
+
+// ---------------------------------------------------------------------------
+static void mfence() { asm volatile("DSB ISH"); }
+
+// ---------------------------------------------------------------------------
+static void stream_chunk(char* p, size_t length) {
+    size_t value = 0x5a5a5a5a5a5a5a5aull, i;
+    for (i = 0; i < length; i += 16) asm volatile("STNP %0, %1, [%2]" ::"r"(value), "r"(value), "r"(p + i) : "memory");
+    asm volatile("DSB ISH");
+}
+#endif
+
+typedef struct {
+    double latency_ns;
+    double read_gbs, write_gbs, stream_gbs, rmw_gbs;
+} result_t;
+
+static char* buffer;
+static size_t buffer_size = 16 << 20, loads = 1 << 16;
+static int duration_ms = 200;
+
+static uint64_t timestamp() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return t.tv_sec * 1000 * 1000 * 1000ULL + t.tv_nsec;
+}
+
+static void flush_buffer() {
+    size_t i;
+    for (i = 0; i < buffer_size; i += LINE) flush(buffer + i);
+    mfence();
+}
+
+// ---------------------------------------------------------------------------
+static int apply_mt(int mt) {
+    /* The kernel writes back and invalidates the cached lines, otherwise they would alias with uncached accesses */
+    return ptedit_set_mt_range(buffer, buffer_size, 0, mt);
+}
+
+// ---------------------------------------------------------------------------
+static double load_latency() {
+    size_t lines = buffer_size / LINE, i, j, tmp, *order;
+    void** p;
+    uint64_t start;
+
+    /* Random cyclic permutation of all lines (Sattolo), such that the prefetcher cannot help */
+    order = malloc(lines * sizeof(size_t));
+    if (!order) return -1;
+    for (i = 0; i < lines; i++) order[i] = i;
+    for (i = lines - 1; i > 0; i--) {
+        j = rand() % i;
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (i = 0; i < lines; i++) {
+        *(void**)(buffer + order[i] * LINE) = buffer + order[(i + 1) % lines] * LINE;
+    }
+    free(order);
+    flush_buffer();
+
+    p = (void**)buffer;
+    start = timestamp();
+    for (i = 0; i < loads; i++) p = (void**)*p;
+    /* Keep the chase from being optimized away */
+    asm volatile("" ::"r"(p));
+    return (double)(timestamp() - start) / loads;
+}
+
+/* Runs a kernel on consecutive chunks of the buffer for the configured duration, returns GB/s */
+static double bandwidth(void (*kernel)(char*, size_t)) {
+    uint64_t start = timestamp(), end = start + duration_ms * 1000000ull, now;
+    size_t bytes = 0, offset = 0;
+
+    do {
+        kernel(buffer + offset, CHUNK);
+        bytes += CHUNK;
+        offset = (offset + CHUNK) % buffer_size;
+    } while ((now = timestamp()) < end);
+    return bytes / (double)(now - start);
+}
+
+static void read_chunk(char* p, size_t length) {
+    volatile size_t* words = (volatile size_t*)p;
+    size_t sum = 0, i;
+    for (i = 0; i < length / sizeof(size_t); i++) sum += words[i];
+    asm volatile("" ::"r"(sum));
+}
+
+static void write_chunk(char* p, size_t length) {
+    volatile size_t* words = (volatile size_t*)p;
+    size_t i;
+    for (i = 0; i < length / sizeof(size_t); i++) words[i] = i;
+}
+
+static void rmw_chunk(char* p, size_t length) {
+    volatile size_t* words = (volatile size_t*)p;
+    size_t i;
+    for (i = 0; i < length / sizeof(size_t); i++) words[i] += 1;
+}
+
+// ---------------------------------------------------------------------------
+int main(int argc, char *argv[]) {
+    int cpu = 0, json = 0, opt, original, first = 1;
+    size_t t;
+    result_t result;
+    cpu_set_t set;
+
+    while ((opt = getopt(argc, argv, "s:n:d:c:jh")) != -1) {
+        switch (opt) {
+            case 's': buffer_size = strtoull(optarg, NULL, 0) << 20; break;
+            case 'n': loads = strtoull(optarg, NULL, 0); break;
+            case 'd': duration_ms = atoi(optarg); break;
+            case 'c': cpu = atoi(optarg); break;
+            case 'j': json = 1; break;
+            default:
+                printf("Usage: %s [-s buffer MB] [-n loads] [-d duration ms] [-c cpu] [-j]\n", argv[0]);
+                printf("  -n  Dependent loads for the latency measurement (default 65536)\n");
+                printf("  -d  Duration of every bandwidth measurement (default 200 ms)\n");
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!buffer_size || !loads || duration_ms < 1) {
+        printf(TAG_FAIL "Error: Invalid arguments\n");
+        return 1;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        printf(TAG_FAIL "Error: Could not pin to CPU %d\n", cpu);
+        return 1;
+    }
+
+    if (ptedit_init()) {
+        printf(TAG_FAIL "Error: Could not initalize PTEditor, did you load the kernel module?\n");
+        return 1;
+    }
+
+    /* Small pages only, every page gets its own PTE */
+    buffer = mmap(0, buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) return 1;
+    madvise(buffer, buffer_size, MADV_NOHUGEPAGE);
+    memset(buffer, 1, buffer_size);
+    mlock(buffer, buffer_size);
+    original = ptedit_extract_mt(ptedit_resolve(buffer, 0).pte);
+
+    if (json) printf("{\"cpu\":%d,\"buffer_bytes\":%zu,\"loads\":%zu,\"duration_ms\":%d,\"results\":[", cpu, buffer_size, loads, duration_ms);
+    else printf("%-4s %4s %12s %12s %12s %12s %12s\n", "type", "slot", "load [ns]", "read GB/s", "write GB/s", "nt GB/s", "rmw GB/s");
+
+    for (t = 0; t < TYPES; t++) {
+        /* Types which are not programmed get a slot until the next type is measured */
+        int borrowed = ptedit_find_first_mt(types[t]) == -1;
+        int mt = ptedit_mt_alloc(types[t]);
+        if (mt == -1) {
+            if (!json) printf(TAG_FAIL "No slot available for %s\n", ptedit_mt_to_string(types[t]));
+            continue;
+        }
+        if (apply_mt(mt)) {
+            printf(TAG_FAIL "Error: Could not apply MT%d\n", mt);
+            break;
+        }
+        result.latency_ns = load_latency();
+        result.read_gbs = bandwidth(read_chunk);
+        result.write_gbs = bandwidth(write_chunk);
+        result.stream_gbs = bandwidth(stream_chunk);
+        result.rmw_gbs = bandwidth(rmw_chunk);
+
+        if (json) {
+            printf("%s{\"type\":\"%s\",\"slot\":%d,\"borrowed\":%s,\"load_ns\":%.1f,\"read_gbs\":%.3f,\"write_gbs\":%.3f,\"nt_write_gbs\":%.3f,\"rmw_gbs\":%.3f}",
+                   first ? "" : ",", ptedit_mt_to_string(types[t]), mt, borrowed ? "true" : "false",
+                   result.latency_ns, result.read_gbs, result.write_gbs, result.stream_gbs, result.rmw_gbs);
+            first = 0;
+        } else {
+            printf("%-4s %3d%s %12.1f %12.3f %12.3f %12.3f %12.3f\n", ptedit_mt_to_string(types[t]), mt, borrowed ? "*" : " ",
+                   result.latency_ns, result.read_gbs, result.write_gbs, result.stream_gbs, result.rmw_gbs);
+        }
+
+        /* Switch back before giving the slot back, nothing may use a slot while it changes */
+        apply_mt(original);
+        ptedit_mt_release(mt);
+    }
+
+    if (json) printf("]}\n");
+    else printf(TAG_OK "Done (* slot reprogrammed for the measurement)\n");
+
+    munmap(buffer, buffer_size);
+    ptedit_cleanup();
+    return 0;
+}
@@ -1,6 +1,13 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <memory.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "../ptedit_header.h"
 
 #define COLOR_RED "\x1b[31m"
@@ -12,35 +19,63 @@
 #define TAG_FAIL COLOR_RED "[-]" COLOR_RESET " "
 #define TAG_PROGRESS COLOR_YELLOW "[~]" COLOR_RESET " "
 
-unsigned long target;
+/* Page-table bit toggled by the set/clear benchmarks, ignored by the hardware */
+#if defined(__aarch64__)
+#define BENCH_BIT 56
+#else
+#define BENCH_BIT PTEDIT_PAGE_BIT_SOFTW3
+#endif
 
+#define HUGE_PAGE_SIZE (2ull << 20)
 
-uint64_t rdtsc() {
-#if defined(__i386__) || defined(__x86_64__)
-  uint64_t a, d;
-  asm volatile("mfence");
-  asm volatile("rdtsc" : "=a"(a), "=d"(d));
-  a = (d << 32) | a;
-  asm volatile("mfence");
-  return a;
-#elif defined(__aarch64__)
-#include <time.h>
-  struct timespec t1;
-  clock_gettime(CLOCK_MONOTONIC, &t1);
-  return t1.tv_sec * 1000 * 1000 * 1000ULL + t1.tv_nsec;
-#endif
-}
+typedef struct {
+    const char* name;
+    int id;
+} implementation_t;
+
+static implementation_t implementations[] = {
+    {"kernel", PTEDIT_IMPL_KERNEL},
+    {"user_pread", PTEDIT_IMPL_USER_PREAD},
+    {"user", PTEDIT_IMPL_USER},
+    {"sim", PTEDIT_IMPL_SIM},
+};
+#define IMPLEMENTATIONS (sizeof(implementations) / sizeof(implementations[0]))
+
+typedef struct {
+    const char* name;
+    char** addresses;
+    size_t* pfns;
+    size_t count;
+} address_set_t;
+
+typedef void (*operation_fn_t)(address_set_t* set, size_t index);
+
+typedef struct {
+    const char* name;
+    operation_fn_t run;
+    /* Operations that do not go through the page-table implementation are measured once */
+    int uses_implementation;
+} operation_t;
+
+static int pagesize;
+static char* page_buffer;
+/* Implementation all others are compared to, the simulation if there is no kernel module */
+static int reference_implementation = PTEDIT_IMPL_KERNEL;
 
-#define REPEAT 10000
+static uint64_t timestamp() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return t.tv_sec * 1000 * 1000 * 1000ULL + t.tv_nsec;
+}
 
 int is_same(ptedit_entry_t* e1, ptedit_entry_t* e2) {
-    int diff = 0;
+    size_t diff = 0;
     if((e1->valid & PTEDIT_VALID_MASK_PGD) && (e2->valid & PTEDIT_VALID_MASK_PGD)) {
         diff |= e1->pgd ^ e2->pgd;
     }
     if((e1->valid & PTEDIT_VALID_MASK_P4D) && (e2->valid & PTEDIT_VALID_MASK_P4D)) {
         diff |= e1->p4d ^ e2->p4d;
-    }    
+    }
     if((e1->valid & PTEDIT_VALID_MASK_PUD) && (e2->valid & PTEDIT_VALID_MASK_PUD)) {
         diff |= e1->pud ^ e2->pud;
     }
@@ -50,60 +85,337 @@ int is_same(ptedit_entry_t* e1, ptedit_entry_t* e2) {
     if((e1->valid & PTEDIT_VALID_MASK_PTE) && (e2->valid & PTEDIT_VALID_MASK_PTE)) {
         diff |= e1->pte ^ e2->pte;
     }
-    return !diff;
+    return !diff && e1->valid == e2->valid;
+}
+
+// ---------------------------------------------------------------------------
+static void op_resolve(address_set_t* set, size_t index) {
+    volatile ptedit_entry_t entry = ptedit_resolve(set->addresses[index], 0);
+    (void)entry;
+}
+
+static void op_update(address_set_t* set, size_t index) {
+    /* Writes back the entries that were just read */
+    ptedit_entry_t entry = ptedit_resolve(set->addresses[index], 0);
+    ptedit_update(set->addresses[index], 0, &entry);
+}
+
+static void op_set_bit(address_set_t* set, size_t index) {
+    ptedit_pte_set_bit(set->addresses[index], 0, BENCH_BIT);
+}
+
+static void op_clear_bit(address_set_t* set, size_t index) {
+    ptedit_pte_clear_bit(set->addresses[index], 0, BENCH_BIT);
+}
+
+static void op_invalidate(address_set_t* set, size_t index) {
+    ptedit_invalidate_tlb(set->addresses[index]);
+}
+
+static void op_read_page(address_set_t* set, size_t index) {
+    ptedit_read_physical_page(set->pfns[index], page_buffer);
+}
+
+static void op_write_page(address_set_t* set, size_t index) {
+    /* Writes back the current content of the page */
+    memcpy(page_buffer, set->addresses[index], pagesize);
+    ptedit_write_physical_page(set->pfns[index], page_buffer);
+}
+
+static void op_pmap(address_set_t* set, size_t index) {
+    volatile char* mapping = (volatile char*)ptedit_pmap(set->pfns[index] * pagesize, pagesize);
+    if (mapping) {
+        (void)*mapping;
+        ptedit_punmap((void*)mapping, pagesize);
+    }
+}
+
+static operation_t operations[] = {
+    {"resolve", op_resolve, 1},
+    {"update", op_update, 1},
+    {"set_bit", op_set_bit, 1},
+    {"clear_bit", op_clear_bit, 1},
+    {"invalidate", op_invalidate, 0},
+    {"read_page", op_read_page, 0},
+    {"write_page", op_write_page, 0},
+    {"pmap", op_pmap, 0},
+};
+#define OPERATIONS (sizeof(operations) / sizeof(operations[0]))
+
+// ---------------------------------------------------------------------------
+static int create_set(address_set_t* set, const char* name, size_t count) {
+    size_t i, pages, stride = 1;
+    char* region;
+
+    set->name = name;
+    set->count = count;
+    set->addresses = malloc(count * sizeof(char*));
+    set->pfns = malloc(count * sizeof(size_t));
+    if (!set->addresses || !set->pfns) return -1;
+
+    if (!strcmp(name, "huge")) {
+        /* Consecutive pages inside transparent huge pages, resolved to a PMD leaf */
+        pages = ((count * pagesize + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * (HUGE_PAGE_SIZE / pagesize);
+        region = mmap(0, pages * pagesize + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) return -1;
+        region = (char*)(((size_t)region + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+        madvise(region, pages * pagesize, MADV_HUGEPAGE);
+    } else {
+        /* Random addresses are spread over a larger region to defeat caching of the upper levels */
+        if (!strcmp(name, "random")) stride = 64;
+        pages = count * stride;
+        region = mmap(0, pages * pagesize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        set->addresses[i] = region + i * stride * pagesize;
+    }
+    if (stride > 1) {
+        for (i = count - 1; i > 0; i--) {
+            size_t j = (size_t)rand() % (i + 1);
+            char* tmp = set->addresses[i];
+            set->addresses[i] = set->addresses[j];
+            set->addresses[j] = tmp;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        *(volatile char*)set->addresses[i] = (char)i;
+    }
+    return 0;
+}
+
+static void lookup_pfns(address_set_t* set) {
+    size_t i;
+    for (i = 0; i < set->count; i++) {
+        set->pfns[i] = ptedit_pte_get_pfn(set->addresses[i], 0);
+        if (!set->pfns[i]) {
+            /* Large page, the frame is the base of the PMD leaf (without the PAT bit) plus the offset */
+            ptedit_entry_t entry = ptedit_resolve(set->addresses[i], 0);
+            set->pfns[i] = (ptedit_get_pfn(entry.pmd) & ~(HUGE_PAGE_SIZE / pagesize - 1)) + (((size_t)set->addresses[i] & (HUGE_PAGE_SIZE - 1)) / pagesize);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    uint64_t min, p50, p99, p999, max;
+    double mean;
+} summary_t;
+
+static summary_t summarize(uint64_t* samples, size_t count) {
+    summary_t summary;
+    size_t i;
+    double sum = 0;
+    qsort(samples, count, sizeof(uint64_t), compare_u64);
+    for (i = 0; i < count; i++) sum += samples[i];
+    summary.min = samples[0];
+    summary.p50 = samples[count / 2];
+    summary.p99 = samples[(size_t)(count * 0.99)];
+    summary.p999 = samples[(size_t)(count * 0.999)];
+    summary.max = samples[count - 1];
+    summary.mean = sum / count;
+    return summary;
+}
+
+static summary_t measure(operation_t* op, address_set_t* set, uint64_t* samples, size_t count, size_t warmup) {
+    size_t i;
+    uint64_t start;
+    for (i = 0; i < warmup; i++) {
+        op->run(set, i % set->count);
+    }
+    for (i = 0; i < count; i++) {
+        start = timestamp();
+        op->run(set, i % set->count);
+        samples[i] = timestamp() - start;
+    }
+    return summarize(samples, count);
+}
+
+// ---------------------------------------------------------------------------
+static size_t crosscheck(address_set_t* set, int implementation) {
+    size_t i, mismatches = 0;
+    ptedit_entry_t reference, entry;
+    for (i = 0; i < set->count; i++) {
+        ptedit_use_implementation(PTEDIT_IMPL_KERNEL);
+        reference = ptedit_resolve(set->addresses[i], 0);
+        ptedit_use_implementation(implementation);
+        entry = ptedit_resolve(set->addresses[i], 0);
+        if (!is_same(&reference, &entry)) mismatches++;
+    }
+    ptedit_use_implementation(PTEDIT_IMPL_KERNEL);
+    return mismatches;
+}
+
+static int selected(const char* list, const char* name) {
+    size_t length = strlen(name);
+    const char* match = list;
+    if (!list) return 1;
+    while ((match = strstr(match, name))) {
+        if ((match == list || match[-1] == ',') && (match[length] == ',' || match[length] == 0)) return 1;
+        match += length;
+    }
+    return 0;
+}
+
+static void usage(const char* name) {
+    printf("Usage: %s [-n samples] [-a addresses] [-w warmup] [-c cpu] [-i implementations] [-o operations] [-s sets] [-m MB] [-j]\n", name);
+    printf("  -n  Measurements per operation (default 10000)\n");
+    printf("  -a  Number of addresses per address set (default 512)\n");
+    printf("  -w  Warmup iterations per operation (default 1000)\n");
+    printf("  -c  CPU to pin to, -1 to not pin (default 0)\n");
+    printf("  -i  Comma-separated implementations (kernel,user_pread,user,sim)\n");
+    printf("  -o  Comma-separated operations (resolve,update,set_bit,clear_bit,invalidate,read_page,write_page,pmap)\n");
+    printf("  -s  Comma-separated address sets (sequential,random,huge)\n");
+    printf("  -m  Simulated physical memory in MB for the sim implementation (default 0, no simulation)\n");
+    printf("      Without the kernel module, only the simulation is measured\n");
+    printf("  -j  Print the results as JSON\n");
 }
 
 int main(int argc, char *argv[]) {
+    size_t samples_count = 10000, addresses = 512, warmup = 1000, sim_mb = 0;
+    int cpu = 0, json = 0, opt, failed = 0, first = 1;
+    const char *impl_filter = NULL, *op_filter = NULL, *set_filter = NULL;
+    const char* set_names[] = {"sequential", "random", "huge"};
+    address_set_t sets[3];
+    size_t s, i, o, mismatches;
+    uint64_t* samples;
+
+    while ((opt = getopt(argc, argv, "n:a:w:c:i:o:s:m:jh")) != -1) {
+        switch (opt) {
+            case 'n': samples_count = strtoull(optarg, NULL, 0); break;
+            case 'a': addresses = strtoull(optarg, NULL, 0); break;
+            case 'w': warmup = strtoull(optarg, NULL, 0); break;
+            case 'c': cpu = atoi(optarg); break;
+            case 'i': impl_filter = optarg; break;
+            case 'o': op_filter = optarg; break;
+            case 's': set_filter = optarg; break;
+            case 'm': sim_mb = strtoull(optarg, NULL, 0); break;
+            case 'j': json = 1; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!samples_count || !addresses) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set)) {
+            fprintf(stderr, TAG_FAIL "Error: Could not pin to CPU %d\n", cpu);
+            return 1;
+        }
+    }
+
     if (ptedit_init()) {
-      printf(TAG_FAIL "Error: Could not initalize PTEditor, did you load the kernel module?\n");
-      return 1;
+        if (!sim_mb) {
+            fprintf(stderr, TAG_FAIL "Error: Could not initalize PTEditor, did you load the kernel module?\n");
+            return 1;
+        }
+        reference_implementation = PTEDIT_IMPL_SIM;
+    }
+    if (sim_mb && ptedit_sim_init(NULL, sim_mb << 20)) {
+        fprintf(stderr, TAG_FAIL "Error: Could not set up the simulated MMU\n");
+        return 1;
     }
+    ptedit_use_implementation(reference_implementation);
+    pagesize = ptedit_get_pagesize();
+    page_buffer = malloc(pagesize);
+    samples = malloc(samples_count * sizeof(uint64_t));
+    if (!page_buffer || !samples) return 1;
 
-    target = 'X';
-    size_t phys = 0;
+    srand(1);
+    for (s = 0; s < 3; s++) {
+        if (!selected(set_filter, set_names[s])) {
+            sets[s].count = 0;
+            continue;
+        }
+        if (create_set(&sets[s], set_names[s], addresses)) {
+            fprintf(stderr, TAG_FAIL "Error: Could not create the %s address set\n", set_names[s]);
+            return 1;
+        }
+    }
+    if (sim_mb) {
+        /* The synthetic page tables mirror the memory map including the address sets */
+        ptedit_use_implementation(PTEDIT_IMPL_SIM);
+        if (ptedit_sim_load_maps(0) <= 0) {
+            fprintf(stderr, TAG_FAIL "Error: Could not build the simulated page tables\n");
+            return 1;
+        }
+        ptedit_use_implementation(reference_implementation);
+    }
+    for (s = 0; s < 3; s++) {
+        if (sets[s].count) lookup_pfns(&sets[s]);
+    }
+
+    if (json) printf("{\"cpu\":%d,\"samples\":%zu,\"addresses\":%zu,\"warmup\":%zu,\"crosscheck\":[", cpu, samples_count, addresses, warmup);
+
+    /* All implementations have to resolve every address exactly like the kernel, the simulation has its own page tables */
+    for (s = 0; s < 3; s++) {
+        if (!sets[s].count || reference_implementation != PTEDIT_IMPL_KERNEL) continue;
+        for (i = 1; i < IMPLEMENTATIONS; i++) {
+            if (!selected(impl_filter, implementations[i].name) || implementations[i].id == PTEDIT_IMPL_SIM) continue;
+            mismatches = crosscheck(&sets[s], implementations[i].id);
+            failed |= !!mismatches;
+            if (json) {
+                printf("%s{\"set\":\"%s\",\"implementation\":\"%s\",\"mismatches\":%zu}", first ? "" : ",", sets[s].name, implementations[i].name, mismatches);
+                first = 0;
+            } else if (mismatches) {
+                printf(TAG_FAIL "%s: %zu of %zu addresses resolve differently with %s and kernel\n", sets[s].name, mismatches, sets[s].count, implementations[i].name);
+            } else {
+                printf(TAG_OK "%s: %s agrees with kernel on all %zu addresses\n", sets[s].name, implementations[i].name, sets[s].count);
+            }
+        }
+    }
+
+    if (json) printf("],\"results\":[");
+    else printf("%-11s %-11s %-11s %9s %9s %9s %9s %9s %9s\n", "impl", "operation", "set", "min", "p50", "p99", "p999", "max", "mean [ns]");
+
+    first = 1;
+    for (i = 0; i < IMPLEMENTATIONS; i++) {
+        if (!selected(impl_filter, implementations[i].name)) continue;
+        if ((implementations[i].id == PTEDIT_IMPL_SIM && !sim_mb) || (reference_implementation == PTEDIT_IMPL_SIM && implementations[i].id != PTEDIT_IMPL_SIM)) continue;
+        ptedit_use_implementation(implementations[i].id);
+        for (o = 0; o < OPERATIONS; o++) {
+            /* Measure implementation-independent operations only once */
+            if (!selected(op_filter, operations[o].name)) continue;
+            if (!operations[o].uses_implementation && implementations[i].id != reference_implementation) continue;
+            for (s = 0; s < 3; s++) {
+                summary_t summary;
+                const char* impl_name = operations[o].uses_implementation ? implementations[i].name : "any";
+                if (!sets[s].count) continue;
+                summary = measure(&operations[o], &sets[s], samples, samples_count, warmup);
+                if (json) {
+                    printf("%s{\"implementation\":\"%s\",\"operation\":\"%s\",\"set\":\"%s\",\"min_ns\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu,\"mean_ns\":%.1f}",
+                           first ? "" : ",", impl_name, operations[o].name, sets[s].name,
+                           (unsigned long long)summary.min, (unsigned long long)summary.p50, (unsigned long long)summary.p99,
+                           (unsigned long long)summary.p999, (unsigned long long)summary.max, summary.mean);
+                    first = 0;
+                } else {
+                    printf("%-11s %-11s %-11s %9llu %9llu %9llu %9llu %9llu %9.1f\n", impl_name, operations[o].name, sets[s].name,
+                           (unsigned long long)summary.min, (unsigned long long)summary.p50, (unsigned long long)summary.p99,
+                           (unsigned long long)summary.p999, (unsigned long long)summary.max, summary.mean);
+                }
+            }
+        }
+    }
+    ptedit_use_implementation(reference_implementation);
+
+    if (json) printf("]}\n");
 
-    int i;
-    ptedit_entry_t entry, entry_us;
-    uint64_t start, stop;
-    
-    ptedit_use_implementation(PTEDIT_IMPL_KERNEL);
-    start = rdtsc();
-    for(i = 0; i < REPEAT; i++) {
-        entry = ptedit_resolve(&target, 0);
-    }
-    stop = rdtsc();
-    printf(TAG_OK "Kernel implementation takes " COLOR_YELLOW "%d" COLOR_RESET " cycles/resolve\n", (int)((stop - start) / REPEAT));
-    
-    ptedit_use_implementation(PTEDIT_IMPL_USER);
-    start = rdtsc();
-    for(i = 0; i < REPEAT; i++) {
-        entry_us = ptedit_resolve(&target, 0);
-    }
-    stop = rdtsc();
-    printf(TAG_OK "User implementation takes " COLOR_YELLOW "%d" COLOR_RESET " cycles/resolve\n", (int)((stop - start) / REPEAT));
-
-    if(!is_same(&entry, &entry_us)) {
-        printf(TAG_FAIL "Kernel and user-space resolver do not agree!\n");
-        ptedit_print_entry_t(entry);
-        ptedit_print_entry_t(entry_us);
-    }
-    
-    ptedit_use_implementation(PTEDIT_IMPL_USER_PREAD);
-    start = rdtsc();
-    for(i = 0; i < REPEAT; i++) {
-        entry_us = ptedit_resolve(&target, 0);
-    }
-    stop = rdtsc();
-    printf(TAG_OK "User (pread) implementation takes " COLOR_YELLOW "%d" COLOR_RESET " cycles/resolve\n", (int)((stop - start) / REPEAT));
-
-    if(!is_same(&entry, &entry_us)) {
-        printf(TAG_FAIL "Kernel and user-space resolver do not agree!\n");
-        ptedit_print_entry_t(entry);
-        ptedit_print_entry_t(entry_us);
-    }
-    
-    
     ptedit_cleanup();
 
-    printf(TAG_OK "Done\n");
+    if (!json) {
+        if (failed) printf(TAG_FAIL "Implementations do not agree!\n");
+        else printf(TAG_OK "Done\n");
+    }
+    return failed;
 }
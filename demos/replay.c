@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../ptedit_header.h"
+
+#define COLOR_RED "\x1b[31m"
+#define COLOR_GREEN "\x1b[32m"
+#define COLOR_YELLOW "\x1b[33m"
+#define COLOR_RESET "\x1b[0m"
+
+#define TAG_OK COLOR_GREEN "[+]" COLOR_RESET " "
+#define TAG_FAIL COLOR_RED "[-]" COLOR_RESET " "
+#define TAG_PROGRESS COLOR_YELLOW "[~]" COLOR_RESET " "
+
+#define OPS 10
+
+static const char* op_names[OPS] = {"resolve", "update", "read_page", "write_page", "get_root", "set_root", "invalidate", "get_mts", "set_mts", "atomic"};
+
+typedef struct {
+    size_t count;
+    double recorded_ns, replayed_ns;
+} op_stats_t;
+
+static uint64_t timestamp() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000 * 1000 * 1000ULL + t.tv_nsec;
+}
+
+static void wait_until(uint64_t deadline) {
+    uint64_t now;
+    /* Sleep through long gaps, spin for the rest to be precise */
+    while ((now = timestamp()) + 100000 < deadline) {
+        struct timespec t = {0, (long)(deadline - now - 100000)};
+        nanosleep(&t, NULL);
+    }
+    while (timestamp() < deadline);
+}
+
+static size_t leaf(ptedit_entry_t* entry) {
+    if (entry->valid & PTEDIT_VALID_MASK_PTE) return entry->pte;
+    return entry->pmd;
+}
+
+// ---------------------------------------------------------------------------
+static void replay(ptedit_trace_record_t* record, size_t* entries, pid_t pid, int writes, char* buffer, size_t* diverged) {
+    ptedit_entry_t entry;
+    size_t recorded;
+    int i;
+
+    switch (record->op) {
+        case PTEDIT_TRACE_RESOLVE:
+            entry = ptedit_resolve((void*)record->arg, pid);
+            /* The recorded leaf is the last entry that followed the record */
+            recorded = 0;
+            for (i = 0; i < 5; i++) {
+                if (record->valid & (1 << i)) recorded = *entries++;
+            }
+            if (entry.valid != record->valid || leaf(&entry) != recorded) (*diverged)++;
+            break;
+        case PTEDIT_TRACE_UPDATE:
+            /* The recorded entries are stale in this process, write back the current ones at the same levels */
+            entry = ptedit_resolve((void*)record->arg, pid);
+            entry.valid &= record->valid;
+            ptedit_update((void*)record->arg, pid, &entry);
+            break;
+        case PTEDIT_TRACE_READ_PAGE:
+            ptedit_read_physical_page(record->arg, buffer);
+            break;
+        case PTEDIT_TRACE_WRITE_PAGE:
+            /* Writing back the current content is only safe if nothing else modifies the page */
+            ptedit_read_physical_page(record->arg, buffer);
+            if (writes) ptedit_write_physical_page(record->arg, buffer);
+            break;
+        case PTEDIT_TRACE_GET_ROOT:
+            ptedit_get_paging_root(pid);
+            break;
+        case PTEDIT_TRACE_SET_ROOT:
+            ptedit_set_paging_root(pid, ptedit_get_paging_root(pid));
+            break;
+        case PTEDIT_TRACE_INVALIDATE_TLB:
+            ptedit_invalidate_tlb((void*)record->arg);
+            break;
+        case PTEDIT_TRACE_GET_MTS:
+            ptedit_get_mts();
+            break;
+        case PTEDIT_TRACE_SET_MTS:
+            ptedit_set_mts(ptedit_get_mts());
+            break;
+        case PTEDIT_TRACE_ATOMIC:
+            /* Setting no bits is as expensive as the recorded operation but does not change anything */
+            ptedit_pte_fetch_or((void*)record->arg, pid, 0);
+            break;
+    }
+}
+
+static void usage(const char* name) {
+    printf("Usage: %s [-i implementation] [-t] [-p pid] [-m MB] [-l layout] [-w] [-j] trace\n", name);
+    printf("  -i  kernel, user_pread, user, or sim (default kernel)\n");
+    printf("  -t  Preserve the original timing instead of replaying at full speed\n");
+    printf("  -p  Issue all calls for this pid instead of the recorded ones\n");
+    printf("  -m  Simulated physical memory in MB for sim (default 1024)\n");
+    printf("  -l  Layout for sim captured with ptedit_sim_capture (default: own memory map)\n");
+    printf("  -w  Also replay physical page writes (as write-back of the current content)\n");
+    printf("  -j  Print the results as JSON\n");
+}
+
+// ---------------------------------------------------------------------------
+int main(int argc, char *argv[]) {
+    const char* implementation_names[] = {"kernel", "user_pread", "user", "sim"};
+    const char *layout = NULL, *impl_name = "kernel";
+    int implementation = -1, timing = 0, writes = 0, json = 0, opt, i, first = 1;
+    pid_t pid = -1;
+    size_t sim_mb = 1024, records = 0, diverged = 0, entries[5];
+    uint64_t start, elapsed, span = 0;
+    op_stats_t stats[OPS];
+    ptedit_trace_header_t header;
+    ptedit_trace_record_t record;
+    char* buffer;
+    FILE* trace;
+
+    while ((opt = getopt(argc, argv, "i:tp:m:l:wjh")) != -1) {
+        switch (opt) {
+            case 'i': impl_name = optarg; break;
+            case 't': timing = 1; break;
+            case 'p': pid = atoi(optarg); break;
+            case 'm': sim_mb = strtoull(optarg, NULL, 0); break;
+            case 'l': layout = optarg; break;
+            case 'w': writes = 1; break;
+            case 'j': json = 1; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    for (i = 0; i < 4; i++) {
+        if (!strcmp(impl_name, implementation_names[i])) implementation = i;
+    }
+    if (optind != argc - 1 || implementation < 0 || !sim_mb) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    trace = fopen(argv[optind], "rb");
+    if (!trace || fread(&header, sizeof(header), 1, trace) != 1 || memcmp(header.magic, PTEDIT_TRACE_MAGIC, sizeof(header.magic))) {
+        fprintf(stderr, TAG_FAIL "Error: %s is not a PTEditor trace\n", argv[optind]);
+        return 1;
+    }
+
+    if (implementation == PTEDIT_IMPL_SIM) {
+        /* The simulation does not need the kernel module */
+        ptedit_init();
+        if (ptedit_sim_init(NULL, sim_mb << 20) || (layout ? ptedit_sim_load_layout(layout) : ptedit_sim_load_maps(0)) <= 0) {
+            fprintf(stderr, TAG_FAIL "Error: Could not set up the simulated MMU\n");
+            return 1;
+        }
+    } else {
+        if (ptedit_init()) {
+            fprintf(stderr, TAG_FAIL "Error: Could not initalize PTEditor, did you load the kernel module?\n");
+            return 1;
+        }
+        ptedit_use_implementation(implementation);
+    }
+    buffer = malloc(header.pagesize > 4096 ? header.pagesize : 4096);
+    if (!buffer) return 1;
+    memset(stats, 0, sizeof(stats));
+
+    if (!json) printf(TAG_PROGRESS "Replaying %s with %s%s\n", argv[optind], impl_name, timing ? ", original timing" : "");
+
+    start = timestamp();
+    while (fread(&record, sizeof(record), 1, trace) == 1) {
+        int count = __builtin_popcount(record.valid & 0x1f);
+        uint64_t before;
+        if (count && fread(entries, sizeof(size_t), count, trace) != (size_t)count) break;
+        if (record.op >= OPS) continue;
+        if (timing) wait_until(start + record.time);
+        before = timestamp();
+        replay(&record, entries, pid >= 0 ? pid : (pid_t)record.pid, writes, buffer, &diverged);
+        stats[record.op].replayed_ns += timestamp() - before;
+        stats[record.op].recorded_ns += record.duration;
+        stats[record.op].count++;
+        span = record.time + record.duration;
+        records++;
+    }
+    elapsed = timestamp() - start;
+    fclose(trace);
+
+    if (json) {
+        printf("{\"implementation\":\"%s\",\"timing\":%s,\"records\":%zu,\"recorded_ns\":%llu,\"replayed_ns\":%llu,\"diverged_resolves\":%zu,\"ops\":[",
+               impl_name, timing ? "true" : "false", records, (unsigned long long)span, (unsigned long long)elapsed, diverged);
+    } else {
+        printf("%-11s %10s %16s %16s\n", "operation", "count", "recorded [ns]", "replayed [ns]");
+    }
+    for (i = 0; i < OPS; i++) {
+        if (!stats[i].count) continue;
+        if (json) {
+            printf("%s{\"op\":\"%s\",\"count\":%zu,\"recorded_mean_ns\":%.1f,\"replayed_mean_ns\":%.1f}", first ? "" : ",", op_names[i],
+                   stats[i].count, stats[i].recorded_ns / stats[i].count, stats[i].replayed_ns / stats[i].count);
+            first = 0;
+        } else {
+            printf("%-11s %10zu %16.1f %16.1f\n", op_names[i], stats[i].count, stats[i].recorded_ns / stats[i].count, stats[i].replayed_ns / stats[i].count);
+        }
+    }
+    if (json) {
+        printf("]}\n");
+    } else {
+        printf(TAG_OK "%zu calls in %.3f ms (recorded: %.3f ms)\n", records, elapsed / 1e6, span / 1e6);
+        if (diverged) printf(TAG_PROGRESS "%zu resolves returned different entries than recorded\n", diverged);
+    }
+
+    free(buffer);
+    ptedit_cleanup();
+    return 0;
+}
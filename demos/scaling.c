@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "../ptedit_header.h"
+
+#define COLOR_RED "\x1b[31m"
+#define COLOR_GREEN "\x1b[32m"
+#define COLOR_YELLOW "\x1b[33m"
+#define COLOR_RESET "\x1b[0m"
+
+#define TAG_OK COLOR_GREEN "[+]" COLOR_RESET " "
+#define TAG_FAIL COLOR_RED "[-]" COLOR_RESET " "
+#define TAG_PROGRESS COLOR_YELLOW "[~]" COLOR_RESET " "
+
+#define MAX_WORKERS 256
+
+/* One cache line per worker to not measure false sharing */
+typedef struct {
+    volatile size_t ops;
+    char padding[64 - sizeof(size_t)];
+} counter_t;
+
+/* Shared between all workers, also across processes */
+typedef struct {
+    volatile int ready;
+    volatile int start;
+    volatile int stop;
+    counter_t counters[MAX_WORKERS];
+} control_t;
+
+typedef struct {
+    int id;
+    int update;
+    char* region;
+    pthread_t thread;
+} worker_t;
+
+static control_t* control;
+static int pagesize;
+static size_t region_pages = 256;
+static int implementation = PTEDIT_IMPL_KERNEL;
+static int use_processes = 0;
+
+static uint64_t timestamp() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000 * 1000 * 1000ULL + t.tv_nsec;
+}
+
+static char* allocate_region(int shared) {
+    char* region = mmap(0, region_pages * pagesize, PROT_READ | PROT_WRITE, (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) return NULL;
+    return region;
+}
+
+// ---------------------------------------------------------------------------
+static void* worker_run(void* arg) {
+    worker_t* worker = (worker_t*)arg;
+    size_t i, ops = 0;
+    ptedit_entry_t entry;
+
+    /* Dirty all pages first, updates write back the entries as they were read */
+    for (i = 0; i < region_pages; i++) {
+        worker->region[i * pagesize] = 1;
+    }
+    __sync_fetch_and_add(&control->ready, 1);
+    while (!control->start) sched_yield();
+
+    for (i = 0; !control->stop; i++) {
+        char* address = worker->region + (i % region_pages) * pagesize;
+        entry = ptedit_resolve(address, 0);
+        if (worker->update) ptedit_update(address, 0, &entry);
+        ops++;
+    }
+    control->counters[worker->id].ops = ops;
+    return NULL;
+}
+
+static double run(int workers, int shared, int update, int duration_ms) {
+    worker_t worker[MAX_WORKERS];
+    pid_t pids[MAX_WORKERS];
+    char* shared_region = NULL;
+    uint64_t start, stop;
+    size_t ops = 0;
+    int i;
+
+    memset(control, 0, sizeof(*control));
+    if (shared) {
+        /* Shared memory, such that processes map the same frames with their own page tables */
+        shared_region = allocate_region(1);
+        if (!shared_region) return -1;
+    }
+
+    for (i = 0; i < workers; i++) {
+        worker[i].id = i;
+        worker[i].update = update;
+        worker[i].region = shared_region;
+        if (use_processes) {
+            pids[i] = fork();
+            if (pids[i] < 0) return -1;
+            if (pids[i] == 0) {
+                /* The child inherits the open device, but has its own paging root */
+                ptedit_use_implementation(implementation);
+                if (!shared) worker[i].region = allocate_region(0);
+                if (!worker[i].region) {
+                    __sync_fetch_and_add(&control->ready, 1);
+                    _exit(1);
+                }
+                worker_run(&worker[i]);
+                _exit(0);
+            }
+        } else {
+            if (!shared) worker[i].region = allocate_region(0);
+            if (!worker[i].region) return -1;
+            if (pthread_create(&worker[i].thread, NULL, worker_run, &worker[i])) return -1;
+        }
+    }
+
+    while (control->ready != workers) sched_yield();
+    start = timestamp();
+    control->start = 1;
+    usleep(duration_ms * 1000);
+    control->stop = 1;
+    stop = timestamp();
+
+    for (i = 0; i < workers; i++) {
+        if (use_processes) {
+            waitpid(pids[i], NULL, 0);
+        } else {
+            pthread_join(worker[i].thread, NULL);
+            if (!shared) munmap(worker[i].region, region_pages * pagesize);
+        }
+        ops += control->counters[i].ops;
+    }
+    if (shared) munmap(shared_region, region_pages * pagesize);
+
+    return ops / ((stop - start) / 1e9);
+}
+
+// ---------------------------------------------------------------------------
+int main(int argc, char *argv[]) {
+    const char* implementation_names[] = {"kernel", "user_pread", "user"};
+    const char* mode_names[] = {"disjoint", "shared"};
+    const char* op_names[] = {"resolve", "update"};
+    int max_workers = (int)sysconf(_SC_NPROCESSORS_ONLN), duration_ms = 1000;
+    int json = 0, opt, workers, mode, op, first = 1;
+
+    while ((opt = getopt(argc, argv, "t:d:r:i:pjh")) != -1) {
+        switch (opt) {
+            case 't': max_workers = atoi(optarg); break;
+            case 'd': duration_ms = atoi(optarg); break;
+            case 'r': region_pages = strtoull(optarg, NULL, 0); break;
+            case 'i': implementation = atoi(optarg); break;
+            case 'p': use_processes = 1; break;
+            case 'j': json = 1; break;
+            default:
+                printf("Usage: %s [-t max workers] [-d duration ms] [-r region pages] [-i implementation] [-p] [-j]\n", argv[0]);
+                printf("  -i  0 (kernel), 1 (user_pread), or 2 (user)\n");
+                printf("  -p  Use processes instead of threads\n");
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (max_workers < 1 || max_workers > MAX_WORKERS || duration_ms < 1 || !region_pages ||
+        implementation < PTEDIT_IMPL_KERNEL || implementation > PTEDIT_IMPL_USER) {
+        printf(TAG_FAIL "Error: Invalid arguments\n");
+        return 1;
+    }
+
+    if (ptedit_init()) {
+        printf(TAG_FAIL "Error: Could not initalize PTEditor, did you load the kernel module?\n");
+        return 1;
+    }
+    ptedit_use_implementation(implementation);
+    pagesize = ptedit_get_pagesize();
+    control = mmap(0, sizeof(control_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (control == MAP_FAILED) return 1;
+
+    if (json) {
+        printf("{\"implementation\":\"%s\",\"workers\":\"%s\",\"duration_ms\":%d,\"region_pages\":%zu,\"results\":[",
+               implementation_names[implementation], use_processes ? "processes" : "threads", duration_ms, region_pages);
+    } else {
+        printf(TAG_PROGRESS "%s implementation, %s, %d ms per run\n", implementation_names[implementation], use_processes ? "processes" : "threads", duration_ms);
+        printf("%-9s %-8s %7s %14s %14s\n", "mode", "op", "workers", "ops/s", "ops/s/worker");
+    }
+
+    for (mode = 0; mode < 2; mode++) {
+        for (op = 0; op < 2; op++) {
+            for (workers = 1; ; workers = (workers * 2 > max_workers && workers < max_workers) ? max_workers : workers * 2) {
+                double throughput = run(workers, mode, op, duration_ms);
+                if (throughput < 0) {
+                    printf(TAG_FAIL "Error: Could not start %d workers\n", workers);
+                    return 1;
+                }
+                if (json) {
+                    printf("%s{\"mode\":\"%s\",\"op\":\"%s\",\"workers\":%d,\"ops_per_s\":%.0f,\"ops_per_s_per_worker\":%.0f}",
+                           first ? "" : ",", mode_names[mode], op_names[op], workers, throughput, throughput / workers);
+                    first = 0;
+                } else {
+                    printf("%-9s %-8s %7d %14.0f %14.0f\n", mode_names[mode], op_names[op], workers, throughput, throughput / workers);
+                }
+                if (workers >= max_workers) break;
+            }
+        }
+    }
+
+    if (json) printf("]}\n");
+    else printf(TAG_OK "Done\n");
+
+    ptedit_cleanup();
+    return 0;
+}
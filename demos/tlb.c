@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include "../ptedit_header.h"
+
+#define COLOR_RED "\x1b[31m"
+#define COLOR_GREEN "\x1b[32m"
+#define COLOR_YELLOW "\x1b[33m"
+#define COLOR_RESET "\x1b[0m"
+
+#define TAG_OK COLOR_GREEN "[+]" COLOR_RESET " "
+#define TAG_FAIL COLOR_RED "[-]" COLOR_RESET " "
+#define TAG_PROGRESS COLOR_YELLOW "[~]" COLOR_RESET " "
+
+#define WARMUP 100
+
+typedef struct {
+    const char* name;
+    int id;
+    /* The kernel decides which CPUs are flushed */
+    int ignores_cpus;
+} strategy_t;
+
+static strategy_t strategies[] = {
+    {"default", PTEDIT_TLB_STRATEGY_DEFAULT, 0},
+    {"invlpg", PTEDIT_TLB_STRATEGY_INVLPG, 0},
+    {"invpcid", PTEDIT_TLB_STRATEGY_INVPCID, 0},
+    {"invpcid_all", PTEDIT_TLB_STRATEGY_INVPCID_ALL, 0},
+    {"cr4_pge", PTEDIT_TLB_STRATEGY_CR4_PGE, 0},
+    {"full_mm", PTEDIT_TLB_STRATEGY_FULL_MM, 1},
+    {"shootdown", PTEDIT_TLB_STRATEGY_SHOOTDOWN, 0},
+};
+#define STRATEGIES (sizeof(strategies) / sizeof(strategies[0]))
+
+char target[4096];
+
+static uint64_t timestamp() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return t.tv_sec * 1000 * 1000 * 1000ULL + t.tv_nsec;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int popcount(size_t mask) {
+    int count = 0;
+    for (; mask; mask &= mask - 1) count++;
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    size_t repeat = 10000, s, c, i, configs = 0;
+    int cpu = 0, json = 0, opt, cpus, first = 1;
+    uint64_t* samples;
+    const char* config_name[66];
+    size_t config_mask[66];
+
+    while ((opt = getopt(argc, argv, "n:c:jh")) != -1) {
+        switch (opt) {
+            case 'n': repeat = strtoull(optarg, NULL, 0); break;
+            case 'c': cpu = atoi(optarg); break;
+            case 'j': json = 1; break;
+            default:
+                printf("Usage: %s [-n repetitions] [-c cpu] [-j]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 64) cpus = 64;
+    if (!repeat || cpu < 0 || cpu >= cpus) {
+        printf(TAG_FAIL "Error: Invalid arguments\n");
+        return 1;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        printf(TAG_FAIL "Error: Could not pin to CPU %d\n", cpu);
+        return 1;
+    }
+
+    if (ptedit_init()) {
+        printf(TAG_FAIL "Error: Could not initalize PTEditor, did you load the kernel module?\n");
+        return 1;
+    }
+    samples = malloc(repeat * sizeof(uint64_t));
+    if (!samples) return 1;
+    target[0] = 1;
+
+    /* Only the own CPU, only a remote CPU, then a growing number of CPUs including the own one */
+    config_name[configs] = "local";
+    config_mask[configs++] = 1ull << cpu;
+    if (cpus > 1) {
+        config_name[configs] = "remote";
+        config_mask[configs++] = 1ull << ((cpu + 1) % cpus);
+    }
+    for (c = 2; c < (size_t)cpus; c *= 2) {
+        config_name[configs] = "cpus";
+        config_mask[configs++] = ((1ull << c) - 1) | (1ull << cpu);
+    }
+    config_name[configs] = "all";
+    config_mask[configs++] = 0;
+
+    if (json) printf("{\"cpu\":%d,\"online_cpus\":%d,\"repetitions\":%zu,\"results\":[", cpu, cpus, repeat);
+    else printf("%-12s %-8s %5s %10s %10s %10s %12s\n", "strategy", "cpus", "count", "p50 [ns]", "p99 [ns]", "p999 [ns]", "mean [ns]");
+
+    for (s = 0; s < STRATEGIES; s++) {
+        for (c = 0; c < configs; c++) {
+            double sum = 0;
+            int count = config_mask[c] ? popcount(config_mask[c]) : cpus;
+            if (strategies[s].ignores_cpus && config_mask[c]) continue;
+            if (ptedit_set_tlb_strategy(strategies[s].id, config_mask[c])) {
+                if (!json) printf(TAG_FAIL "%s is not supported\n", strategies[s].name);
+                break;
+            }
+            for (i = 0; i < WARMUP; i++) {
+                ptedit_invalidate_tlb(target);
+            }
+            for (i = 0; i < repeat; i++) {
+                uint64_t start = timestamp();
+                ptedit_invalidate_tlb(target);
+                samples[i] = timestamp() - start;
+                sum += samples[i];
+            }
+            qsort(samples, repeat, sizeof(uint64_t), compare_u64);
+            if (json) {
+                printf("%s{\"strategy\":\"%s\",\"cpus\":\"%s\",\"mask\":%zu,\"count\":%d,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"mean_ns\":%.1f}",
+                       first ? "" : ",", strategies[s].name, config_name[c], config_mask[c], count,
+                       (unsigned long long)samples[repeat / 2], (unsigned long long)samples[(size_t)(repeat * 0.99)],
+                       (unsigned long long)samples[(size_t)(repeat * 0.999)], sum / repeat);
+                first = 0;
+            } else {
+                printf("%-12s %-8s %5d %10llu %10llu %10llu %12.1f\n", strategies[s].name, config_name[c], count,
+                       (unsigned long long)samples[repeat / 2], (unsigned long long)samples[(size_t)(repeat * 0.99)],
+                       (unsigned long long)samples[(size_t)(repeat * 0.999)], sum / repeat);
+            }
+        }
+    }
+    ptedit_set_tlb_strategy(PTEDIT_TLB_STRATEGY_DEFAULT, 0);
+
+    if (json) printf("]}\n");
+    else printf(TAG_OK "Done\n");
+
+    ptedit_cleanup();
+    return 0;
+}
@@ -97,6 +97,7 @@ int main(int argc, char *argv[]) {
   } else {
       printf(TAG_FAIL "Fail!\n");
   }
+  ptedit_punmap(new_addr, ptedit_get_pagesize());
   
 
   printf(TAG_OK "Overwriting physical page of target with " COLOR_YELLOW "C" COLOR_RESET "s\n");
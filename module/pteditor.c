@@ -1,6 +1,7 @@
 #include <asm/tlbflush.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
+#include <asm/cacheflush.h>
 #include <linux/fs.h>
 #include <linux/fs.h>
 #include <linux/kallsyms.h>
@@ -12,9 +13,24 @@
 #include <linux/proc_fs.h>
 #include <linux/kprobes.h>
 #include <linux/page_ref.h>
+#include <linux/pfn_t.h>
+#include <linux/huge_mm.h>
+#include <linux/pagemap.h>
+#include <linux/rmap.h>
+#include <linux/slab.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/mm.h>
+#include <linux/mmu_notifier.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
 
 #include "pteditor.h"
 
+#define CREATE_TRACE_POINTS
+#include "pteditor_trace.h"
+
 MODULE_AUTHOR("Michael Schwarz");
 MODULE_DESCRIPTION("Device to play around with paging structures");
 MODULE_LICENSE("GPL");
@@ -83,6 +99,47 @@ unsigned long kallsyms_lookup_name(const char* name) {
 }
 #endif
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0) && defined(CONFIG_TRANSPARENT_HUGEPAGE)
+/* Huge PFN mappings are only torn down correctly since vma_is_special_huge() */
+#define PTEDITOR_HUGE_MMAP
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0)
+/* The mmap lock API replaced direct accesses to mmap_sem in 5.8 */
+static inline void mmap_read_lock(struct mm_struct *mm) {
+  down_read(&mm->mmap_sem);
+}
+
+static inline int mmap_read_trylock(struct mm_struct *mm) {
+  return down_read_trylock(&mm->mmap_sem);
+}
+
+static inline void mmap_read_unlock(struct mm_struct *mm) {
+  up_read(&mm->mmap_sem);
+}
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 17, 0)
+typedef int vm_fault_t;
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 20, 0)
+static vm_fault_t vmf_insert_pfn_prot(struct vm_area_struct *vma, unsigned long addr, unsigned long pfn, pgprot_t prot) {
+  int err = vm_insert_pfn_prot(vma, addr, pfn, prot);
+
+  if(err == -ENOMEM) return VM_FAULT_OOM;
+  if(err < 0 && err != -EBUSY) return VM_FAULT_SIGBUS;
+  return VM_FAULT_NOPAGE;
+}
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+/* vm_flags became read-only in 6.3 */
+static inline void vm_flags_set(struct vm_area_struct *vma, unsigned long flags) {
+  vma->vm_flags |= flags;
+}
+#endif
+
 typedef struct {
     size_t pid;
     pgd_t *pgd;
@@ -100,6 +157,10 @@ typedef struct {
 static bool device_busy = false;
 static bool mm_is_locked = false;
 
+/* Selected by the user for benchmarking, reset when the device is closed */
+static int tlb_strategy = PTEDIT_TLB_STRATEGY_DEFAULT;
+static struct cpumask tlb_cpus;
+
 static int device_open(struct inode *inode, struct file *file) {
   /* Check if device is busy */
   if (device_busy == true) {
@@ -115,6 +176,10 @@ static int device_open(struct inode *inode, struct file *file) {
 }
 
 static int device_release(struct inode *inode, struct file *file) {
+  /* Benchmark settings do not outlive the session */
+  tlb_strategy = PTEDIT_TLB_STRATEGY_DEFAULT;
+  cpumask_clear(&tlb_cpus);
+
   /* Unlock module */
   device_busy = false;
 
@@ -123,39 +188,224 @@ static int device_release(struct inode *inode, struct file *file) {
   return 0;
 }
 
+/* Statistics, indexed by the number of the ioctl command */
+#define PTEDITOR_STATS_COMMANDS 64
+/* Bucket i counts latencies in [2^(i-1), 2^i) ns, the last bucket everything above */
+#define PTEDITOR_STATS_BUCKETS 32
+
+typedef struct {
+  u64 calls[PTEDITOR_STATS_COMMANDS];
+  u64 total_ns[PTEDITOR_STATS_COMMANDS];
+  u64 histogram[PTEDITOR_STATS_COMMANDS][PTEDITOR_STATS_BUCKETS];
+  u64 flush_ipis;
+  u64 mmap_sem_contended;
+  u64 mmap_sem_wait_ns;
+} pteditor_stats_t;
+
+static DEFINE_PER_CPU(pteditor_stats_t, pteditor_stats);
+static bool stats_enabled = false;
+static struct dentry *stats_dir;
+
+static void stats_account(unsigned int cmd, u64 ns) {
+  if(cmd >= PTEDITOR_STATS_COMMANDS) return;
+  this_cpu_inc(pteditor_stats.calls[cmd]);
+  this_cpu_add(pteditor_stats.total_ns[cmd], ns);
+  this_cpu_inc(pteditor_stats.histogram[cmd][min(fls64(ns), PTEDITOR_STATS_BUCKETS - 1)]);
+}
+
+static void stats_flush_ipis(unsigned int ipis) {
+  if(READ_ONCE(stats_enabled)) this_cpu_add(pteditor_stats.flush_ipis, ipis);
+}
+
+static void lock_mm(struct mm_struct *mm) {
+  u64 start;
+
+  if(!READ_ONCE(stats_enabled)) {
+    mmap_read_lock(mm);
+    return;
+  }
+  /* Only the time spent waiting on a contended semaphore is accounted */
+  if(mmap_read_trylock(mm)) return;
+  start = ktime_get_ns();
+  mmap_read_lock(mm);
+  this_cpu_inc(pteditor_stats.mmap_sem_contended);
+  this_cpu_add(pteditor_stats.mmap_sem_wait_ns, ktime_get_ns() - start);
+}
+
+static void unlock_mm(struct mm_struct *mm) {
+  mmap_read_unlock(mm);
+}
+
 static void
-_invalidate_tlb(void *addr) {
+_invalidate_tlb_all(void *unused) {
 #if defined(__i386__) || defined(__x86_64__)
-  int pcid;
   unsigned long flags;
   unsigned long cr4;
 
+  /* Toggling CR4.PGE flushes all entries of all PCIDs, including global ones */
+  raw_local_irq_save(flags);
+  cr4 = this_cpu_read(cpu_tlbstate.cr4);
+  native_write_cr4(cr4 & ~X86_CR4_PGE);
+  native_write_cr4(cr4);
+  raw_local_irq_restore(flags);
+#elif defined(__aarch64__)
+  asm volatile ("dsb ishst");
+  asm volatile ("tlbi vmalle1is");
+  asm volatile ("dsb ish");
+  asm volatile ("isb");
+#endif
+}
+
+/* Not exported, resolved at load time */
+static void (*flush_tlb_mm_range_fn)(struct mm_struct *mm, unsigned long start, unsigned long end,
+                                     unsigned int stride_shift, bool freed_tables);
+
+static void
+_invalidate_tlb(void *addr) {
+#if defined(__i386__) || defined(__x86_64__)
+  int pcid;
+
+  switch (READ_ONCE(tlb_strategy)) {
+    case PTEDIT_TLB_STRATEGY_INVLPG:
+      asm volatile ("invlpg (%0)": : "r"(addr) : "memory");
+      return;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+    /* Only selectable with INVPCID support, see tlb_strategy_supported */
+    case PTEDIT_TLB_STRATEGY_INVPCID:
+      /* Only the PCID that is currently loaded */
+      invpcid_flush_one(__read_cr3() & X86_CR3_PCID_MASK, (unsigned long) addr);
+      return;
+    case PTEDIT_TLB_STRATEGY_INVPCID_ALL:
+      for(pcid = 0; pcid < 4096; pcid++) {
+        invpcid_flush_one(pcid, (unsigned long) addr);
+      }
+      return;
+#endif
+    case PTEDIT_TLB_STRATEGY_CR4_PGE:
+      _invalidate_tlb_all(NULL);
+      return;
+    default:
+      break;
+  }
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 2, 98)
   if (cpu_feature_enabled(X86_FEATURE_INVPCID_SINGLE)) {
     for(pcid = 0; pcid < 4096; pcid++) {
       invpcid_flush_one(pcid, (long unsigned int) addr);
     }
   } else {
-    raw_local_irq_save(flags);
-    cr4 = this_cpu_read(cpu_tlbstate.cr4);
-    native_write_cr4(cr4 & ~X86_CR4_PGE);
-    native_write_cr4(cr4);
-    raw_local_irq_restore(flags);
+    _invalidate_tlb_all(NULL);
   }
 #else
   asm volatile ("invlpg (%0)": : "r"(addr));
 #endif
 #elif defined(__aarch64__)
-  asm volatile ("dsb ishst");
-  asm volatile ("tlbi vmalle1is");
-  asm volatile ("dsb ish");
-  asm volatile ("isb");
+  _invalidate_tlb_all(NULL);
 #endif
 }
 
+#if defined(__i386__) || defined(__x86_64__)
+static void tlb_shootdown(const struct cpumask *mask) {
+  struct mm_struct *mm = this_cpu_read(cpu_tlbstate.loaded_mm);
+  struct flush_tlb_info info = {
+    .mm = mm, .start = 0, .end = TLB_FLUSH_ALL,
+    .stride_shift = 0, .freed_tables = true,
+    .new_tlb_gen = inc_mm_tlb_gen(mm)};
+
+  stats_flush_ipis(cpumask_weight(mask) - cpumask_test_cpu(smp_processor_id(), mask));
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+  /* Renamed in 5.11, the kernel's own flush now also covers the local CPU */
+  flush_tlb_multi(mask, &info);
+#else
+  flush_tlb_others(mask, &info);
+#endif
+}
+#endif
+
 static void
 invalidate_tlb(unsigned long addr) {
-  on_each_cpu(_invalidate_tlb, (void*) addr, 1);
+  u64 start = trace_pteditor_flush_enabled() ? ktime_get_ns() : 0;
+  const struct cpumask *mask = cpumask_empty(&tlb_cpus) ? cpu_online_mask : &tlb_cpus;
+
+  switch (tlb_strategy) {
+    case PTEDIT_TLB_STRATEGY_FULL_MM:
+      /* The kernel's own flush of the whole address space on all CPUs using it */
+#if defined(__i386__) || defined(__x86_64__)
+      if (flush_tlb_mm_range_fn && current->mm) {
+        flush_tlb_mm_range_fn(current->mm, 0, TLB_FLUSH_ALL, 0, true);
+        break;
+      }
+#elif defined(__aarch64__)
+      if (current->mm) {
+        flush_tlb_mm(current->mm);
+        break;
+      }
+#endif
+      goto ipi;
+#if defined(__i386__) || defined(__x86_64__)
+    case PTEDIT_TLB_STRATEGY_SHOOTDOWN:
+      preempt_disable();
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 11, 0)
+      /* Before 5.11, the kernel's shootdown only interrupts remote CPUs */
+      if (cpumask_test_cpu(smp_processor_id(), mask)) _invalidate_tlb_all(NULL);
+#endif
+      tlb_shootdown(mask);
+      preempt_enable();
+      break;
+#endif
+    default:
+ipi:
+      stats_flush_ipis(cpumask_weight(mask) - cpumask_test_cpu(raw_smp_processor_id(), mask));
+      on_each_cpu_mask(mask, _invalidate_tlb, (void*) addr, 1);
+      break;
+  }
+  if(start) trace_pteditor_flush(addr, 0, ktime_get_ns() - start);
+}
+
+/* Strategies that _invalidate_tlb and invalidate_tlb can execute on this CPU and kernel */
+static bool tlb_strategy_supported(size_t strategy) {
+  switch (strategy) {
+    case PTEDIT_TLB_STRATEGY_DEFAULT:
+    case PTEDIT_TLB_STRATEGY_FULL_MM:
+      return true;
+#if defined(__i386__) || defined(__x86_64__)
+    case PTEDIT_TLB_STRATEGY_INVLPG:
+    case PTEDIT_TLB_STRATEGY_CR4_PGE:
+    case PTEDIT_TLB_STRATEGY_SHOOTDOWN:
+      return true;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+    case PTEDIT_TLB_STRATEGY_INVPCID:
+    case PTEDIT_TLB_STRATEGY_INVPCID_ALL:
+      return cpu_feature_enabled(X86_FEATURE_INVPCID_SINGLE);
+#endif
+#endif
+    default:
+      return false;
+  }
+}
+
+static int set_tlb_strategy(ptedit_tlb_strategy_t *request) {
+  int cpu;
+
+  if (request->strategy > PTEDIT_TLB_STRATEGY_SHOOTDOWN) return -EINVAL;
+  if (!tlb_strategy_supported(request->strategy)) return -EOPNOTSUPP;
+  cpumask_clear(&tlb_cpus);
+  for (cpu = 0; cpu < min_t(int, nr_cpu_ids, BITS_PER_LONG); cpu++) {
+    if (request->cpus & (1ul << cpu)) cpumask_set_cpu(cpu, &tlb_cpus);
+  }
+  cpumask_and(&tlb_cpus, &tlb_cpus, cpu_online_mask);
+  if (request->cpus && cpumask_empty(&tlb_cpus)) return -EINVAL;
+  tlb_strategy = request->strategy;
+  return 0;
+}
+
+static void
+invalidate_tlb_all(void) {
+  u64 start = trace_pteditor_flush_enabled() ? ktime_get_ns() : 0;
+
+  stats_flush_ipis(num_online_cpus() - 1);
+  on_each_cpu(_invalidate_tlb_all, NULL, 1);
+  if(start) trace_pteditor_flush(0, 1, ktime_get_ns() - start);
 }
 
 static void _set_pat(void* _pat) {
@@ -171,8 +421,24 @@ static void _set_pat(void* _pat) {
 #endif
 }
 
+static size_t get_pat(void) {
+#if defined(__i386__) || defined(__x86_64__)
+    int low, high;
+    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(0x277));
+    return low | (((size_t)high) << 32);
+#elif defined(__aarch64__)
+    uint64_t value;
+    asm volatile ("mrs %0, mair_el1\n" : "=r"(value));
+    return value;
+#endif
+}
+
 static void set_pat(size_t pat) {
+    u64 start = trace_pteditor_set_pat_enabled() ? ktime_get_ns() : 0;
+    size_t old_pat = start ? get_pat() : 0;
+
     on_each_cpu(_set_pat, (void*) pat, 1);
+    if(start) trace_pteditor_set_pat(old_pat, pat, ktime_get_ns() - start);
 }
 
 static struct mm_struct* get_mm(size_t pid) {
@@ -195,10 +461,7 @@ static struct mm_struct* get_mm(size_t pid) {
   return NULL;
 }
 
-static int resolve_vm(size_t addr, vm_t* entry, int lock) {
-  struct mm_struct *mm;
-
-  if(!entry) return 1;
+static int resolve_mm(struct mm_struct *mm, size_t addr, vm_t* entry, int lock) {
   entry->pud = NULL;
   entry->pmd = NULL;
   entry->pgd = NULL;
@@ -206,13 +469,12 @@ static int resolve_vm(size_t addr, vm_t* entry, int lock) {
   entry->p4d = NULL;
   entry->valid = 0;
 
-  mm = get_mm(entry->pid);
   if(!mm) {
       return 1;
   }
 
   /* Lock mm */
-  if(lock) down_read(&mm->mmap_sem);
+  if(lock) lock_mm(mm);
 
   /* Return PGD (page global directory) entry */
   entry->pgd = pgd_offset(mm, addr);
@@ -269,31 +531,58 @@ static int resolve_vm(size_t addr, vm_t* entry, int lock) {
   pte_unmap(entry->pte);
 
   /* Unlock mm */
-  if(lock) up_read(&mm->mmap_sem);
+  if(lock) unlock_mm(mm);
 
   return 0;
 
 error_out:
 
   /* Unlock mm */
-  if(lock) up_read(&mm->mmap_sem);
+  if(lock) unlock_mm(mm);
 
   return 1;
 }
 
+/* Value of the lowest level in mask, e.g., the PTE if it is valid */
+static size_t vm_leaf(vm_t* vm, size_t mask) {
+  mask &= vm->valid;
+  if(mask & PTEDIT_VALID_MASK_PTE) return pte_val(*(vm->pte));
+  if(mask & PTEDIT_VALID_MASK_PMD) return pmd_val(*(vm->pmd));
+  if(mask & PTEDIT_VALID_MASK_PUD) return pud_val(*(vm->pud));
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+  if(mask & PTEDIT_VALID_MASK_P4D) return p4d_val(*(vm->p4d));
+#endif
+  if(mask & PTEDIT_VALID_MASK_PGD) return pgd_val(*(vm->pgd));
+  return 0;
+}
+
+static int resolve_vm(size_t addr, vm_t* entry, int lock) {
+  u64 start;
+  int ret;
+
+  if(!entry) return 1;
+  start = trace_pteditor_resolve_enabled() ? ktime_get_ns() : 0;
+  ret = resolve_mm(get_mm(entry->pid), addr, entry, lock);
+  if(start) trace_pteditor_resolve(entry->pid, addr, entry->valid, vm_leaf(entry, ~0ul), ktime_get_ns() - start);
+  return ret;
+}
+
 
 static int update_vm(ptedit_entry_t* new_entry, int lock) {
   vm_t old_entry;
   size_t addr = new_entry->vaddr;
   struct mm_struct *mm = get_mm(new_entry->pid);
+  u64 start = trace_pteditor_update_enabled() ? ktime_get_ns() : 0;
+  size_t old_leaf = 0;
   if(!mm) return 1;
 
   old_entry.pid = new_entry->pid;
 
   /* Lock mm */
-  if(lock) down_read(&mm->mmap_sem);
+  if(lock) lock_mm(mm);
 
   resolve_vm(addr, &old_entry, 0);
+  if(start) old_leaf = vm_leaf(&old_entry, new_entry->valid);
 
   /* Update entries */
   if((old_entry.valid & PTEDIT_VALID_MASK_PGD) && (new_entry->valid & PTEDIT_VALID_MASK_PGD)) {
@@ -325,12 +614,1030 @@ static int update_vm(ptedit_entry_t* new_entry, int lock) {
 
   invalidate_tlb(addr);
 
+  if(start) {
+    trace_pteditor_update(new_entry->pid, addr, old_entry.valid & new_entry->valid, old_leaf,
+                          vm_leaf(&old_entry, new_entry->valid), ktime_get_ns() - start);
+  }
+
   /* Unlock mm */
-  if(lock) up_read(&mm->mmap_sem);
+  if(lock) unlock_mm(mm);
+
+  return 0;
+}
+
+
+/* Physical transfers are split into chunks to allow rescheduling in between */
+#define PTEDITOR_COPY_CHUNK (1ul << 20)
+/* Writes of at least this size bypass the cache */
+#define PTEDITOR_COPY_NOCACHE_THRESHOLD (256ul << 10)
+
+static int copy_physical_range(ptedit_page_t* page, int write) {
+  size_t size = page->size ? page->size : PAGE_SIZE;
+  size_t offset, chunk, pfn;
+  unsigned char *kaddr;
 
+  /* The raw copies below do not check the user pointer themselves */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+  if(!access_ok(page->buffer, size)) return -EFAULT;
+#else
+  if(!access_ok(write ? VERIFY_READ : VERIFY_WRITE, page->buffer, size)) return -EFAULT;
+#endif
+
+  /* The whole run has to be covered by the direct mapping */
+  for(pfn = page->pfn; pfn < page->pfn + DIV_ROUND_UP(size, PAGE_SIZE); pfn++) {
+    if(!pfn_valid(pfn)) return -EINVAL;
+  }
+
+  kaddr = phys_to_virt(page->pfn * PAGE_SIZE);
+  for(offset = 0; offset < size; offset += chunk) {
+    chunk = min(size - offset, PTEDITOR_COPY_CHUNK);
+    if(!write) {
+      if(to_user(page->buffer + offset, kaddr + offset, chunk)) return -EFAULT;
+    } else if(size >= PTEDITOR_COPY_NOCACHE_THRESHOLD) {
+      if(__copy_from_user_inatomic_nocache(kaddr + offset, page->buffer + offset, chunk)) return -EFAULT;
+    } else {
+      if(from_user(kaddr + offset, page->buffer + offset, chunk)) return -EFAULT;
+    }
+    cond_resched();
+  }
   return 0;
 }
 
+static int copy_physical(ptedit_page_t* page, int write) {
+  u64 start = trace_pteditor_page_enabled() ? ktime_get_ns() : 0;
+  int ret = copy_physical_range(page, write);
+
+  if(start) trace_pteditor_page(page->pfn, page->size ? page->size : PAGE_SIZE, write, ret, ktime_get_ns() - start);
+  return ret;
+}
+
+/* Upper bound for the mappings returned per page */
+#define PTEDITOR_RMAP_MAX_MAPPINGS 4096
+
+/* Not exported, resolved at load time; walks folios instead of pages since 5.18 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+static void (*rmap_walk_fn)(struct folio *folio, struct rmap_walk_control *rwc);
+#else
+static void (*rmap_walk_fn)(struct page *page, struct rmap_walk_control *rwc);
+#endif
+
+typedef struct {
+  size_t pfn;
+  ptedit_rmap_entry_t *mappings;
+  size_t max, found;
+} rmap_query_t;
+
+static size_t mm_to_pid(struct mm_struct *mm) {
+  struct task_struct *task;
+  size_t pid = 0;
+
+  rcu_read_lock();
+#ifdef CONFIG_MEMCG
+  task = rcu_dereference(mm->owner);
+  if(task) pid = task_tgid_vnr(task);
+#else
+  for_each_process(task) {
+    if(task->mm == mm) {
+      pid = task_tgid_vnr(task);
+      break;
+    }
+  }
+#endif
+  rcu_read_unlock();
+  return pid;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+static bool rmap_query_one(struct folio *folio, struct vm_area_struct *vma, unsigned long addr, void *arg) {
+#else
+static bool rmap_query_one(struct page *page, struct vm_area_struct *vma, unsigned long addr, void *arg) {
+#endif
+  rmap_query_t *query = arg;
+  vm_t vm;
+  size_t pfn = 0;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+  /* The address is where the first page of the folio is mapped */
+  addr += (query->pfn - folio_pfn(folio)) << PAGE_SHIFT;
+#endif
+
+  /* The VMA may only cover the page (e.g., after COW), check the actual mapping.
+     The rmap lock held by the walk keeps the page tables of the VMA alive. */
+  resolve_mm(vma->vm_mm, addr, &vm, 0);
+  if(vm.valid & PTEDIT_VALID_MASK_PTE) {
+    if(pte_present(*vm.pte)) pfn = pte_pfn(*vm.pte);
+  } else if((vm.valid & PTEDIT_VALID_MASK_PMD) && pmd_large(*vm.pmd)) {
+    pfn = pmd_pfn(*vm.pmd) + ((addr & ~PMD_MASK) >> PAGE_SHIFT);
+  } else if((vm.valid & PTEDIT_VALID_MASK_PUD) && pud_large(*vm.pud)) {
+    pfn = pud_pfn(*vm.pud) + ((addr & ~PUD_MASK) >> PAGE_SHIFT);
+  }
+  if(pfn != query->pfn) return true;
+
+  query->mappings[query->found].pid = mm_to_pid(vma->vm_mm);
+  query->mappings[query->found].vaddr = addr & PAGE_MASK;
+  query->found++;
+
+  /* Stop the walk once the caller's limit is reached */
+  return query->found < query->max;
+}
+
+static int rmap_query(ptedit_rmap_query_t *request) {
+  struct rmap_walk_control rwc = {0};
+  rmap_query_t query;
+  struct page *page;
+  size_t i;
+  int ret = 0;
+
+  if(!rmap_walk_fn) return -ENOSYS;
+  if(!request->max_mappings || request->max_mappings > PTEDITOR_RMAP_MAX_MAPPINGS) return -EINVAL;
+
+  query.max = request->max_mappings;
+  query.mappings = kmalloc_array(query.max, sizeof(ptedit_rmap_entry_t), GFP_KERNEL);
+  if(!query.mappings) return -ENOMEM;
+  rwc.rmap_one = rmap_query_one;
+  rwc.arg = &query;
+
+  for(i = 0; i < request->count; i++) {
+    if(from_user(&query.pfn, request->pfns + i, sizeof(query.pfn))) {
+      ret = -EFAULT;
+      break;
+    }
+    query.found = 0;
+
+    /* Only pages that are in use can be mapped, and the reference keeps them from being freed */
+    if(pfn_valid(query.pfn)) {
+      page = pfn_to_page(query.pfn);
+      if(get_page_unless_zero(page)) {
+        if(page_mapped(page)) {
+          lock_page(page);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+          rmap_walk_fn(page_folio(page), &rwc);
+#else
+          rmap_walk_fn(page, &rwc);
+#endif
+          unlock_page(page);
+        }
+        put_page(page);
+      }
+    }
+
+    if(to_user(request->found + i, &query.found, sizeof(query.found)) ||
+       to_user(request->mappings + i * query.max, query.mappings, query.found * sizeof(ptedit_rmap_entry_t))) {
+      ret = -EFAULT;
+      break;
+    }
+    cond_resched();
+  }
+
+  kfree(query.mappings);
+  return ret;
+}
+
+/* Not exported, resolved at load time */
+static int (*p4d_alloc_fn)(struct mm_struct *mm, pgd_t *pgd, unsigned long address);
+static int (*pud_alloc_fn)(struct mm_struct *mm, p4d_t *p4d, unsigned long address);
+static int (*pmd_alloc_fn)(struct mm_struct *mm, pud_t *pud, unsigned long address);
+static int (*pte_alloc_fn)(struct mm_struct *mm, pmd_t *pmd);
+
+static pmd_t* alloc_pmd(struct mm_struct *mm, unsigned long addr) {
+  pgd_t *pgd;
+  p4d_t *p4d;
+  pud_t *pud;
+
+  pgd = pgd_offset(mm, addr);
+#ifndef __PAGETABLE_P4D_FOLDED
+  if(pgd_none(*pgd) && (!p4d_alloc_fn || p4d_alloc_fn(mm, pgd, addr))) return NULL;
+#endif
+  p4d = p4d_offset(pgd, addr);
+#ifndef __PAGETABLE_PUD_FOLDED
+  if(p4d_none(*p4d) && (!pud_alloc_fn || pud_alloc_fn(mm, p4d, addr))) return NULL;
+#endif
+  pud = pud_offset(p4d, addr);
+  if(pud_large(*pud)) return NULL;
+#ifndef __PAGETABLE_PMD_FOLDED
+  if(pud_none(*pud) && (!pmd_alloc_fn || pmd_alloc_fn(mm, pud, addr))) return NULL;
+#endif
+  return pmd_offset(pud, addr);
+}
+
+/* The kernel drops the counter again when it zaps the mapping, a negative value undoes the accounting */
+static void account_rss(struct mm_struct *mm, struct page *page, long value) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+  add_mm_counter(mm, mm_counter(page_folio(page)), value);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 5, 0)
+  add_mm_counter(mm, mm_counter(page), value);
+#else
+  add_mm_counter(mm, PageAnon(page) ? MM_ANONPAGES : MM_FILEPAGES, value);
+#endif
+}
+
+/* Clears the entries map_range installed before it failed, the page tables stay and are freed with the VMA */
+static void map_range_rollback(struct mm_struct *mm, unsigned long start, unsigned long end) {
+  unsigned long addr, next;
+  spinlock_t *ptl;
+  pmd_t *pmd;
+  pte_t *pte, *ptes;
+
+  for(addr = start; addr < end; addr = next) {
+    next = pmd_addr_end(addr, end);
+    /* All levels down to the PMD exist already, nothing is allocated */
+    pmd = alloc_pmd(mm, addr);
+    if(!pmd || pmd_none(*pmd)) continue;
+    if(pmd_large(*pmd)) {
+      ptl = pmd_lock(mm, pmd);
+      pmd_clear(pmd);
+      spin_unlock(ptl);
+      continue;
+    }
+    ptes = pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+    for(; addr < next; addr += PAGE_SIZE, pte++) pte_clear(mm, addr, pte);
+    pte_unmap_unlock(ptes, ptl);
+  }
+}
+
+static int map_range(ptedit_map_range_t *range, int lock) {
+  struct mm_struct *mm = current->mm;
+  struct vm_area_struct *vma;
+  unsigned long addr, end;
+  pgprot_t prot = range->flags ? __pgprot(range->flags) : PAGE_SHARED;
+  size_t i, next, mapped = 0;
+  spinlock_t *ptl;
+  pmd_t *pmd;
+  pte_t *pte, *ptes;
+  int pfnmap, ret = 0;
+
+  if(!mm || !range->npages || !PAGE_ALIGNED(range->vaddr)) return -EINVAL;
+  /* The frames come from pfn, and the huge-page bit would turn the PTEs into garbage PMDs */
+#if defined(__i386__) || defined(__x86_64__)
+  if(range->flags & (PTE_PFN_MASK | _PAGE_PSE)) return -EINVAL;
+#elif defined(__aarch64__)
+  if(range->flags & PTE_ADDR_MASK) return -EINVAL;
+#endif
+  end = range->vaddr + range->npages * PAGE_SIZE;
+
+  if(lock) lock_mm(mm);
+
+  /* Page tables outside of a VMA would never be freed */
+  vma = find_vma(mm, range->vaddr);
+  if(!vma || vma->vm_start > range->vaddr || end > vma->vm_end || end < range->vaddr) {
+    ret = -EFAULT;
+    goto out;
+  }
+
+  /* Frames in other VMAs are reference counted, the kernel drops the references again on unmap */
+  pfnmap = !!(vma->vm_flags & VM_PFNMAP);
+  if(!pfnmap) {
+    for(i = 0; i < range->npages; i++) {
+      if(!pfn_valid(range->pfn + i)) {
+        ret = -EINVAL;
+        goto out;
+      }
+    }
+  }
+
+  for(i = 0; i < range->npages; i = next) {
+    addr = range->vaddr + i * PAGE_SIZE;
+    pmd = alloc_pmd(mm, addr);
+    if(!pmd) {
+      ret = -ENOMEM;
+      break;
+    }
+
+#if defined(PTEDITOR_HUGE_MMAP)
+    /* Huge PFN mappings are only torn down correctly in PFN-mapped VMAs */
+    if(pfnmap && IS_ALIGNED(addr, PMD_SIZE) && IS_ALIGNED(range->pfn + i, PTRS_PER_PTE) &&
+       range->npages - i >= PTRS_PER_PTE && pmd_none(*pmd)) {
+#if defined(__i386__) || defined(__x86_64__)
+      pmd_t entry = pmd_mkhuge(pfn_pmd(range->pfn + i, pgprot_4k_2_large(prot)));
+#else
+      pmd_t entry = pmd_mkhuge(pfn_pmd(range->pfn + i, prot));
+#endif
+      ptl = pmd_lock(mm, pmd);
+      /* A concurrent fault may have installed a page table meanwhile */
+      if(pmd_none(*pmd)) {
+        set_pmd_at(mm, addr, pmd, entry);
+        spin_unlock(ptl);
+        next = i + PTRS_PER_PTE;
+        mapped = next;
+        continue;
+      }
+      spin_unlock(ptl);
+    }
+#endif
+    if(pmd_large(*pmd)) {
+      ret = -EEXIST;
+      break;
+    }
+    if(pmd_none(*pmd) && (!pte_alloc_fn || pte_alloc_fn(mm, pmd))) {
+      ret = -ENOMEM;
+      break;
+    }
+
+    /* Fill the page table up to its end or the end of the range */
+    next = min(range->npages, i + (size_t)((pmd_addr_end(addr, end) - addr) >> PAGE_SHIFT));
+    ptes = pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+    for(; i < next; i++, pte++, addr += PAGE_SIZE) {
+      if(!pte_none(*pte)) {
+        ret = -EEXIST;
+        break;
+      }
+      set_pte_at(mm, addr, pte, pfnmap ? pte_mkspecial(pfn_pte(range->pfn + i, prot)) : pfn_pte(range->pfn + i, prot));
+    }
+    pte_unmap_unlock(ptes, ptl);
+    mapped = i;
+    if(ret) break;
+  }
+
+  /* The range is mapped as a whole or not at all */
+  if(ret && mapped) map_range_rollback(mm, range->vaddr, range->vaddr + mapped * PAGE_SIZE);
+
+  /* Account all installed frames at once */
+  if(!ret && !pfnmap) {
+    for(i = 0; i < mapped; i++) {
+      struct page *page = pfn_to_page(range->pfn + i);
+      page_ref_inc(page);
+      atomic_inc(&page->_mapcount);
+      account_rss(mm, page, 1);
+    }
+  }
+  if(mapped) invalidate_tlb_all();
+
+out:
+  if(lock) unlock_mm(mm);
+  return ret;
+}
+
+static int map_range_traced(ptedit_map_range_t *range, int lock) {
+  u64 start = trace_pteditor_map_enabled() ? ktime_get_ns() : 0;
+  int ret = map_range(range, lock);
+
+  if(start) trace_pteditor_map(range->vaddr, range->pfn, range->npages, ret, ktime_get_ns() - start);
+  return ret;
+}
+
+
+/* Called for every present leaf of a range with its page-table lock held, returns the new value of the leaf */
+typedef size_t (*leaf_fn_t)(size_t entry, size_t level, unsigned long addr, void *arg);
+
+/* Leaves overlapping the range are visited as a whole and the range is widened to the changed ones, returns the number of changed leaves */
+static long walk_leaves(struct mm_struct *mm, unsigned long *start, unsigned long *end, leaf_fn_t fn, void *arg) {
+  unsigned long addr, next, last = *end;
+  pgd_t *pgd;
+  p4d_t *p4d;
+  pud_t *pud;
+  pmd_t *pmd;
+  pte_t *pte, *ptes;
+  spinlock_t *ptl;
+  size_t old, new;
+  long changed = 0;
+
+  for(addr = *start; addr < last; addr = next) {
+    pgd = pgd_offset(mm, addr);
+    next = pgd_addr_end(addr, last);
+    if(pgd_none(*pgd) || pgd_bad(*pgd)) continue;
+    p4d = p4d_offset(pgd, addr);
+    next = p4d_addr_end(addr, last);
+    if(p4d_none(*p4d) || p4d_bad(*p4d)) continue;
+    pud = pud_offset(p4d, addr);
+    next = pud_addr_end(addr, last);
+    if(pud_none(*pud)) continue;
+    if(pud_large(*pud)) {
+      ptl = pud_lock(mm, pud);
+      /* The leaf may have been split or zapped before the lock was taken */
+      if(pud_large(*pud)) {
+        old = pud_val(*pud);
+        new = fn(old, PTEDIT_VALID_MASK_PUD, addr & PUD_MASK, arg);
+        if(new != old) {
+          set_pud(pud, native_make_pud(new));
+          *start = min(*start, addr & PUD_MASK);
+          *end = max(*end, (addr & PUD_MASK) + PUD_SIZE);
+          changed++;
+        }
+        spin_unlock(ptl);
+        continue;
+      }
+      spin_unlock(ptl);
+      if(pud_none(*pud)) continue;
+    }
+    pmd = pmd_offset(pud, addr);
+    next = pmd_addr_end(addr, last);
+    if(pmd_none(*pmd)) continue;
+    if(pmd_large(*pmd)) {
+      ptl = pmd_lock(mm, pmd);
+      if(pmd_large(*pmd)) {
+        old = pmd_val(*pmd);
+        new = fn(old, PTEDIT_VALID_MASK_PMD, addr & PMD_MASK, arg);
+        if(new != old) {
+          set_pmd(pmd, native_make_pmd(new));
+          *start = min(*start, addr & PMD_MASK);
+          *end = max(*end, (addr & PMD_MASK) + PMD_SIZE);
+          changed++;
+        }
+        spin_unlock(ptl);
+        continue;
+      }
+      spin_unlock(ptl);
+      if(pmd_none(*pmd)) continue;
+    }
+    ptes = pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+    for(; addr < next; addr += PAGE_SIZE, pte++) {
+      if(!pte_present(*pte)) continue;
+      old = pte_val(*pte);
+      new = fn(old, PTEDIT_VALID_MASK_PTE, addr, arg);
+      if(new != old) {
+        set_pte_at(mm, addr, pte, native_make_pte(new));
+        changed++;
+      }
+    }
+    pte_unmap_unlock(ptes, ptl);
+    cond_resched();
+  }
+  return changed;
+}
+
+/* Flushes a range of one address space on the CPUs that use it */
+static void invalidate_tlb_range(struct mm_struct *mm, unsigned long start, unsigned long end) {
+#if defined(__i386__) || defined(__x86_64__)
+  u64 t = trace_pteditor_flush_enabled() ? ktime_get_ns() : 0;
+
+  /* The kernel falls back to a full flush of the mm for large ranges */
+  if(flush_tlb_mm_range_fn) {
+    flush_tlb_mm_range_fn(mm, start, end, PAGE_SHIFT, false);
+    if(t) trace_pteditor_flush(start, 0, ktime_get_ns() - t);
+    return;
+  }
+#endif
+  invalidate_tlb_all();
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+/* Writing back the whole cache is faster than flushing lines from this size on */
+#define PTEDITOR_WBINVD_THRESHOLD (4ul << 20)
+
+static size_t apply_mt_leaf(size_t entry, size_t level, unsigned long addr, void *arg) {
+  size_t mt = *(size_t*)arg;
+  size_t pat = level == PTEDIT_VALID_MASK_PTE ? _PAGE_PAT : _PAGE_PAT_LARGE;
+
+  entry &= ~(_PAGE_PWT | _PAGE_PCD | pat);
+  if(mt & 1) entry |= _PAGE_PWT;
+  if(mt & 2) entry |= _PAGE_PCD;
+  if(mt & 4) entry |= pat;
+  return entry;
+}
+
+static size_t flush_leaf(size_t entry, size_t level, unsigned long addr, void *arg) {
+  unsigned long pfn, size;
+
+  if(level == PTEDIT_VALID_MASK_PTE) {
+    pfn = pte_pfn(native_make_pte(entry));
+    size = PAGE_SIZE;
+  } else if(level == PTEDIT_VALID_MASK_PMD) {
+    pfn = pmd_pfn(native_make_pmd(entry));
+    size = PMD_SIZE;
+  } else {
+    pfn = pud_pfn(native_make_pud(entry));
+    size = PUD_SIZE;
+  }
+  /* Through the direct map, such that this works for any address space; device memory is not in the cache anyway */
+  if(pfn_valid(pfn)) clflush_cache_range(page_address(pfn_to_page(pfn)), size);
+  return entry;
+}
+#endif
+
+static long set_mt_range(ptedit_mt_range_t *range, int lock) {
+#if defined(__i386__) || defined(__x86_64__)
+  struct mm_struct *mm = get_mm(range->pid);
+  unsigned long start = range->vaddr & PAGE_MASK, end = PAGE_ALIGN(range->vaddr + range->length);
+  u64 t = trace_pteditor_range_enabled() ? ktime_get_ns() : 0;
+  long changed;
+
+  if(!mm || range->mt > 7 || end <= start) return -EINVAL;
+  if(lock) lock_mm(mm);
+  /* Widened to whole huge pages, which are retyped even if they only overlap the range */
+  changed = walk_leaves(mm, &start, &end, apply_mt_leaf, &range->mt);
+  if(changed) {
+    /* No CPU may refill a line through a stale entry after the cache is cleaned */
+    invalidate_tlb_range(mm, start, end);
+    if(end - start >= PTEDITOR_WBINVD_THRESHOLD) wbinvd_on_all_cpus();
+    else walk_leaves(mm, &start, &end, flush_leaf, NULL);
+  }
+  if(lock) unlock_mm(mm);
+  if(t) trace_pteditor_range("set_mt", range->vaddr, range->length, changed, ktime_get_ns() - t);
+  return 0;
+#else
+  return -EOPNOTSUPP;
+#endif
+}
+
+static size_t modify_bits_leaf(size_t entry, size_t level, unsigned long addr, void *arg) {
+  ptedit_bits_range_t *range = (ptedit_bits_range_t*)arg;
+  size_t set = range->set, clear = range->clear;
+
+#if defined(__i386__) || defined(__x86_64__)
+  /* Bit 7 is the page size in huge leaves, their PAT bit is bit 12 */
+  if(level != PTEDIT_VALID_MASK_PTE) {
+    set = (set & ~_PAGE_PAT) | ((set & _PAGE_PAT) ? _PAGE_PAT_LARGE : 0);
+    clear = (clear & ~_PAGE_PAT) | ((clear & _PAGE_PAT) ? _PAGE_PAT_LARGE : 0);
+  }
+#endif
+  return (entry & ~clear) | set;
+}
+
+static long modify_bits_range(ptedit_bits_range_t *range, int lock) {
+  struct mm_struct *mm = get_mm(range->pid);
+  unsigned long start = range->vaddr & PAGE_MASK, end = PAGE_ALIGN(range->vaddr + range->length);
+  u64 t = trace_pteditor_range_enabled() ? ktime_get_ns() : 0;
+  long changed;
+
+  if(!mm || end <= start) return -EINVAL;
+#if defined(__i386__) || defined(__x86_64__)
+  /* Frames are not changed in bulk */
+  if((range->set | range->clear) & PTE_PFN_MASK) return -EINVAL;
+#endif
+  if(lock) lock_mm(mm);
+  /* Huge leaves overlapping the range are modified as a whole, the flush covers them entirely */
+  changed = walk_leaves(mm, &start, &end, modify_bits_leaf, range);
+  if(changed) invalidate_tlb_range(mm, start, end);
+  if(lock) unlock_mm(mm);
+  if(t) trace_pteditor_range("modify_bits", range->vaddr, range->length, changed, ktime_get_ns() - t);
+  return 0;
+}
+
+
+/* Returns the PMD of an address if it points to a page table */
+static pmd_t* find_pmd(struct mm_struct *mm, unsigned long addr) {
+  pgd_t *pgd;
+  p4d_t *p4d;
+  pud_t *pud;
+  pmd_t *pmd;
+
+  pgd = pgd_offset(mm, addr);
+  if(pgd_none(*pgd) || pgd_bad(*pgd)) return NULL;
+  p4d = p4d_offset(pgd, addr);
+  if(p4d_none(*p4d) || p4d_bad(*p4d)) return NULL;
+  pud = pud_offset(p4d, addr);
+  if(pud_none(*pud) || pud_large(*pud)) return NULL;
+  pmd = pmd_offset(pud, addr);
+  if(pmd_none(*pmd) || pmd_large(*pmd)) return NULL;
+  return pmd;
+}
+
+/* Copies the PTEs of present source pages and takes a reference on their frames, returns the number of pages copied */
+static size_t alias_gather(struct mm_struct *mm, unsigned long src, size_t npages, size_t *entries) {
+  unsigned long end = src + npages * PAGE_SIZE;
+  size_t i = 0, next;
+  spinlock_t *ptl;
+  pmd_t *pmd;
+  pte_t *pte, *ptes;
+
+  while(i < npages) {
+    /* Huge source pages would have to be split, only 4 kB pages are aliased */
+    pmd = find_pmd(mm, src);
+    if(!pmd) break;
+    next = i + ((pmd_addr_end(src, end) - src) >> PAGE_SHIFT);
+    ptes = pte = pte_offset_map_lock(mm, pmd, src, &ptl);
+    for(; i < next; i++, pte++, src += PAGE_SIZE) {
+      if(!pte_present(*pte)) break;
+      /* Special mappings (e.g., of the PTEditor device) have no reference count */
+      if(!pte_special(*pte)) {
+        if(!pfn_valid(pte_pfn(*pte))) break;
+        get_page(pfn_to_page(pte_pfn(*pte)));
+      }
+      entries[i] = pte_val(*pte);
+    }
+    pte_unmap_unlock(ptes, ptl);
+    if(i < next) break;
+  }
+  return i;
+}
+
+/* Both address spaces are always locked in the same order, such that two concurrent calls cannot deadlock.
+   The address space that is already locked by the caller (VM_LOCK), if any, is skipped. */
+static void lock_mm_pair(struct mm_struct *a, struct mm_struct *b, struct mm_struct *held) {
+  if(a > b) swap(a, b);
+  if(a != held) lock_mm(a);
+  if(a != b && b != held) lock_mm(b);
+}
+
+static void unlock_mm_pair(struct mm_struct *a, struct mm_struct *b, struct mm_struct *held) {
+  if(a != held) unlock_mm(a);
+  if(a != b && b != held) unlock_mm(b);
+}
+
+/* Clears the entries share_range installed before it failed, and drops the references, map counts, and RSS they took */
+static void share_range_rollback(struct mm_struct *mm, unsigned long start, unsigned long end, size_t *entries) {
+  unsigned long addr, next;
+  size_t i, n;
+  spinlock_t *ptl;
+  pmd_t *pmd;
+  pte_t *pte, *ptes;
+
+  for(addr = start; addr < end; addr = next) {
+    next = pmd_addr_end(addr, end);
+    pmd = find_pmd(mm, addr);
+    if(!pmd) continue;
+    n = (next - addr) >> PAGE_SHIFT;
+    ptes = pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+    for(i = 0; i < n; i++, pte++) entries[i] = pte_val(ptep_get_and_clear(mm, addr + i * PAGE_SIZE, pte));
+    pte_unmap_unlock(ptes, ptl);
+    /* The frames may only be released once no TLB entry references them anymore */
+    invalidate_tlb_range(mm, addr, next);
+    for(i = 0; i < n; i++) {
+      pte_t entry = native_make_pte(entries[i]);
+      if(!pte_present(entry) || pte_special(entry)) continue;
+      account_rss(mm, pfn_to_page(pte_pfn(entry)), -1);
+      atomic_dec(&pfn_to_page(pte_pfn(entry))->_mapcount);
+      put_page(pfn_to_page(pte_pfn(entry)));
+    }
+  }
+}
+
+static int share_range(ptedit_share_range_t *range, int lock) {
+  struct mm_struct *src_mm = get_mm(range->src_pid), *mm = get_mm(range->dst_pid);
+  /* VM_LOCK only locks the address space of the caller, any other one is still locked here */
+  struct mm_struct *held = lock ? NULL : current->active_mm;
+  struct vm_area_struct *vma;
+  unsigned long addr, end = range->dst + range->length;
+  u64 t = trace_pteditor_range_enabled() ? ktime_get_ns() : 0;
+  size_t *entries, i, npages, gathered, installed, aliased = 0;
+  spinlock_t *ptl;
+  pmd_t *pmd;
+  pte_t *pte, *ptes;
+  int ret = 0;
+
+  if(!src_mm || !mm || !range->length || !PAGE_ALIGNED(range->dst | range->src | range->length)) return -EINVAL;
+  /* Overlapping ranges would alias pages that were just aliased themselves */
+  if(src_mm == mm && range->src < end && range->dst < range->src + range->length) return -EINVAL;
+  entries = kmalloc_array(PTRS_PER_PTE, sizeof(size_t), GFP_KERNEL);
+  if(!entries) return -ENOMEM;
+
+  lock_mm_pair(src_mm, mm, held);
+
+  /* Page tables outside of a VMA would never be freed */
+  vma = find_vma(mm, range->dst);
+  if(!vma || vma->vm_start > range->dst || end > vma->vm_end || end < range->dst) {
+    ret = -EFAULT;
+    goto out;
+  }
+
+  /* One destination page table per step, the source is gathered before, such that only one page-table lock is held at a time */
+  for(addr = range->dst; addr < end; addr += npages * PAGE_SIZE) {
+    npages = (pmd_addr_end(addr, end) - addr) >> PAGE_SHIFT;
+    pmd = alloc_pmd(mm, addr);
+    if(!pmd) {
+      ret = -ENOMEM;
+      break;
+    }
+    if(pmd_large(*pmd)) {
+      ret = -EEXIST;
+      break;
+    }
+    if(pmd_none(*pmd) && (!pte_alloc_fn || pte_alloc_fn(mm, pmd))) {
+      ret = -ENOMEM;
+      break;
+    }
+
+    gathered = alias_gather(src_mm, range->src + (addr - range->dst), npages, entries);
+    ptes = pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+    for(i = 0; i < gathered; i++, pte++) {
+      if(!pte_none(*pte)) break;
+      set_pte_at(mm, addr + i * PAGE_SIZE, pte, native_make_pte(entries[i]));
+    }
+    pte_unmap_unlock(ptes, ptl);
+    installed = i;
+
+    for(i = 0; i < gathered; i++) {
+      pte_t entry = native_make_pte(entries[i]);
+      if(pte_special(entry)) continue;
+      /* The kernel drops the references and the RSS of installed frames again on unmap */
+      if(i < installed) {
+        atomic_inc(&pfn_to_page(pte_pfn(entry))->_mapcount);
+        account_rss(mm, pfn_to_page(pte_pfn(entry)), 1);
+      } else {
+        put_page(pfn_to_page(pte_pfn(entry)));
+      }
+    }
+    aliased += installed;
+    if(installed < npages) {
+      /* Either a destination page is already populated or a source page is not present */
+      ret = installed < gathered ? -EEXIST : -EFAULT;
+      break;
+    }
+    cond_resched();
+  }
+  /* The range is shared as a whole or not at all */
+  if(ret && aliased) {
+    share_range_rollback(mm, range->dst, range->dst + aliased * PAGE_SIZE, entries);
+    aliased = 0;
+  }
+  /* Only the destination changed, the source keeps its entries */
+  if(aliased) invalidate_tlb_range(mm, range->dst, range->dst + aliased * PAGE_SIZE);
+
+out:
+  unlock_mm_pair(src_mm, mm, held);
+  kfree(entries);
+  if(t) trace_pteditor_range(src_mm == mm ? "alias" : "share", range->dst, range->length, aliased, ktime_get_ns() - t);
+  return ret;
+}
+
+/* Shares within one address space, which share_range locks and rolls back like any other */
+static int alias_range(ptedit_alias_range_t *range, int lock) {
+  ptedit_share_range_t share = {range->pid, range->src, range->pid, range->dst, range->length};
+  return share_range(&share, lock);
+}
+
+
+/* A cloned paging hierarchy, freed on destroy or when the module is unloaded */
+typedef struct {
+  struct list_head list;
+  struct list_head tables;
+  struct page *root;
+  /* Pinned with mmgrab before its tables are copied */
+  struct mm_struct *mm;
+  /* The address space the clone is installed in, and the root it replaced there */
+  struct mm_struct *installed;
+  pgd_t *orig_pgd;
+#ifdef CONFIG_MMU_NOTIFIER
+  /* Restores the original root before the kernel tears down the address space */
+  struct mmu_notifier notifier;
+  bool registered;
+#endif
+} pteditor_clone_t;
+
+typedef struct {
+  pteditor_clone_t *clone;
+  unsigned int shift[5];
+  size_t mask[5], share, tables;
+  int levels;
+} pteditor_clone_walk_t;
+
+static LIST_HEAD(clones);
+static DEFINE_MUTEX(clones_lock);
+
+#if defined(CONFIG_PAGE_TABLE_ISOLATION)
+/* The user-mode copy of the root follows the kernel-mode root */
+#define CLONE_ROOT_ORDER 1
+#define CLONE_ROOT_SIZE (2 * PAGE_SIZE)
+#else
+#define CLONE_ROOT_ORDER 0
+#define CLONE_ROOT_SIZE (PTRS_PER_PGD * sizeof(pgd_t))
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#define TABLE_PRESENT(e) ((e) & _PAGE_PRESENT)
+#define TABLE_IS_LEAF(e) ((e) & _PAGE_PSE)
+#define TABLE_ADDR(e) ((e) & PTE_PFN_MASK)
+#define TABLE_SET_ADDR(e, phys) (((e) & ~PTE_PFN_MASK) | (phys))
+#else
+#define TABLE_PRESENT(e) ((e) & PTE_VALID)
+#define TABLE_IS_LEAF(e) (!((e) & PTE_TABLE_BIT))
+#define TABLE_ADDR(e) __pte_to_phys(__pte(e))
+#define TABLE_SET_ADDR(e, phys) (((e) & ~PTE_ADDR_MASK) | __phys_to_pte_val(phys))
+#endif
+
+/* Levels that are not folded, from the root down */
+static void clone_levels(pteditor_clone_walk_t *walk) {
+  const unsigned int shifts[5] = {PGDIR_SHIFT, P4D_SHIFT, PUD_SHIFT, PMD_SHIFT, PAGE_SHIFT};
+  int i;
+
+  walk->levels = 0;
+  for(i = 0; i < 5; i++) {
+    if(i && shifts[i] == shifts[i - 1]) continue;
+    walk->shift[walk->levels] = shifts[i];
+    walk->mask[walk->levels++] = 1 << i;
+  }
+}
+
+/* Replaces the table entries overlapping the range by copies of the tables below, unless they are shared */
+static int clone_table(pteditor_clone_walk_t *walk, size_t *dst, size_t *src, int level, unsigned long base, unsigned long start, unsigned long end) {
+  unsigned long size = 1ul << walk->shift[level], addr;
+  size_t i, entry, entries = level ? PAGE_SIZE / sizeof(size_t) : PTRS_PER_PGD;
+  struct page *page;
+  int ret;
+
+  if(level + 1 >= walk->levels || (walk->share & walk->mask[level + 1])) return 0;
+  for(i = 0; i < entries; i++) {
+    addr = base + i * size;
+    if(addr + size <= start || addr >= end) continue;
+    entry = READ_ONCE(src[i]);
+    if(!TABLE_PRESENT(entry) || TABLE_IS_LEAF(entry)) continue;
+
+    page = alloc_page(GFP_KERNEL);
+    if(!page) return -ENOMEM;
+    list_add(&page->lru, &walk->clone->tables);
+    memcpy(page_address(page), phys_to_virt(TABLE_ADDR(entry)), PAGE_SIZE);
+    ret = clone_table(walk, page_address(page), phys_to_virt(TABLE_ADDR(entry)), level + 1, addr, start, end);
+    if(ret) return ret;
+    dst[i] = TABLE_SET_ADDR(entry, page_to_phys(page));
+#if defined(CONFIG_PAGE_TABLE_ISOLATION)
+    /* User mode runs on the user-mode copy of the root */
+    if(!level) dst[i + PTRS_PER_PGD] = TABLE_SET_ADDR(dst[i + PTRS_PER_PGD], page_to_phys(page));
+#endif
+    walk->tables++;
+    if(level + 2 == walk->levels) cond_resched();
+  }
+  return 0;
+}
+
+/* Called without clones_lock, unregistering runs the release callback */
+static void clone_free(pteditor_clone_t *clone) {
+  struct page *page, *next;
+
+#ifdef CONFIG_MMU_NOTIFIER
+  if(clone->registered) mmu_notifier_unregister(&clone->notifier, clone->mm);
+#endif
+  list_for_each_entry_safe(page, next, &clone->tables, lru) {
+    list_del(&page->lru);
+    __free_page(page);
+  }
+  if(clone->root) __free_pages(clone->root, CLONE_ROOT_ORDER);
+  if(clone->mm) mmdrop(clone->mm);
+  kfree(clone);
+}
+
+/* Loads the current root of the address space on this CPU if it uses it, and drops all cached translations */
+static void _reload_root(void *arg) {
+  struct mm_struct *mm = arg;
+#if defined(__i386__) || defined(__x86_64__)
+  /* Keeps the PCID of the address space */
+  if(this_cpu_read(cpu_tlbstate.loaded_mm) == mm) write_cr3((__read_cr3() & ~CR3_ADDR_MASK) | __sme_pa(mm->pgd));
+#elif defined(__aarch64__)
+  if(current->active_mm == mm) {
+    /* Keeps the ASID of the address space */
+    write_sysreg((read_sysreg(ttbr0_el1) & TTBR_ASID_MASK) | phys_to_ttbr(virt_to_phys(mm->pgd)), ttbr0_el1);
+    isb();
+  }
+#endif
+  _invalidate_tlb_all(NULL);
+}
+
+/* Restores the root the clone replaced, such that no CPU walks the clone anymore, must hold clones_lock */
+static void clone_uninstall(pteditor_clone_t *clone) {
+  struct mm_struct *mm = clone->installed;
+
+  if(!mm) return;
+  WRITE_ONCE(mm->pgd, clone->orig_pgd);
+  clone->installed = NULL;
+  clone->orig_pgd = NULL;
+  stats_flush_ipis(num_online_cpus() - 1);
+  on_each_cpu(_reload_root, mm, 1);
+}
+
+#ifdef CONFIG_MMU_NOTIFIER
+/* The kernel frees the tables of the installed root on exit, these have to be the original ones */
+static void clone_release(struct mmu_notifier *notifier, struct mm_struct *mm) {
+  pteditor_clone_t *clone = container_of(notifier, pteditor_clone_t, notifier);
+
+  mutex_lock(&clones_lock);
+  clone_uninstall(clone);
+  mutex_unlock(&clones_lock);
+}
+
+static const struct mmu_notifier_ops clone_notifier_ops = {
+  .release = clone_release,
+};
+#endif
+
+/* Installs a root, a clone remembers the original root it replaces until it is uninstalled */
+static int set_root(struct mm_struct *mm, size_t root, int lock) {
+  pteditor_clone_t *clone, *target = NULL;
+  /* VM_LOCK only locks the address space of the caller */
+  bool held = !lock && mm == current->active_mm;
+  pgd_t *orig;
+  int ret = 0;
+
+  mutex_lock(&clones_lock);
+  list_for_each_entry(clone, &clones, list) {
+    if(page_to_phys(clone->root) == root) target = clone;
+  }
+  if(target) {
+    /* The user part of a clone belongs to the address space it was cloned from */
+    if(target->mm != mm) {
+      ret = -EINVAL;
+      goto out;
+    }
+#ifdef CONFIG_MMU_NOTIFIER
+    if(!target->registered) {
+      /* Registering takes the mmap lock for writing, which must not be held by VM_LOCK */
+      if(held) {
+        ret = -EBUSY;
+        goto out;
+      }
+      target->notifier.ops = &clone_notifier_ops;
+      ret = mmu_notifier_register(&target->notifier, mm);
+      if(ret) goto out;
+      target->registered = true;
+    }
+#else
+    /* Without notifier, the kernel would free the clone's tables on exit */
+    ret = -EOPNOTSUPP;
+    goto out;
+#endif
+  }
+
+  if(!held) lock_mm(mm);
+  /* Switching from one clone to another keeps the original root */
+  orig = mm->pgd;
+  list_for_each_entry(clone, &clones, list) {
+    if(clone->installed != mm) continue;
+    orig = clone->orig_pgd;
+    clone->installed = NULL;
+    clone->orig_pgd = NULL;
+  }
+  if(target) {
+    target->installed = mm;
+    target->orig_pgd = orig;
+  }
+  mm->pgd = (pgd_t*)phys_to_virt(root);
+  if(!held) unlock_mm(mm);
+
+out:
+  mutex_unlock(&clones_lock);
+  return ret;
+}
+
+static int clone_root(ptedit_clone_t *request, int lock) {
+  struct mm_struct *mm = get_mm(request->pid);
+  unsigned long start = request->vaddr & PAGE_MASK, end = TASK_SIZE_MAX;
+  u64 t = trace_pteditor_range_enabled() ? ktime_get_ns() : 0;
+  /* VM_LOCK only locks the address space of the caller */
+  bool held = !lock && mm == current->active_mm;
+  pteditor_clone_walk_t walk;
+  int ret;
+
+  if(request->length) end = min(end, PAGE_ALIGN(request->vaddr + request->length));
+  if(!mm || end <= start) return -EINVAL;
+
+  memset(&walk, 0, sizeof(walk));
+  clone_levels(&walk);
+  walk.share = request->share;
+  walk.clone = kzalloc(sizeof(pteditor_clone_t), GFP_KERNEL);
+  if(!walk.clone) return -ENOMEM;
+  INIT_LIST_HEAD(&walk.clone->tables);
+  /* The address space stays allocated as long as the clone, and its tables as long as they are copied */
+  mmgrab(mm);
+  walk.clone->mm = mm;
+  if(!mmget_not_zero(mm)) {
+    clone_free(walk.clone);
+    return -EINVAL;
+  }
+  walk.clone->root = alloc_pages(GFP_KERNEL | __GFP_ZERO, CLONE_ROOT_ORDER);
+  if(!walk.clone->root) {
+    mmput(mm);
+    clone_free(walk.clone);
+    return -ENOMEM;
+  }
+
+  /* Entries outside of the range, including the kernel half, keep pointing to the original tables */
+  if(!held) lock_mm(mm);
+  memcpy(page_address(walk.clone->root), mm->pgd, CLONE_ROOT_SIZE);
+  ret = clone_table(&walk, page_address(walk.clone->root), (size_t*)mm->pgd, 0, 0, start, end);
+  if(!held) unlock_mm(mm);
+  mmput(mm);
+  if(ret) {
+    clone_free(walk.clone);
+    return ret;
+  }
+
+  mutex_lock(&clones_lock);
+  list_add(&walk.clone->list, &clones);
+  mutex_unlock(&clones_lock);
+  request->root = page_to_phys(walk.clone->root);
+  if(t) trace_pteditor_range("clone", start, end - start, walk.tables, ktime_get_ns() - t);
+  return 0;
+}
+
+static int destroy_root(size_t root) {
+  pteditor_clone_t *clone, *found = NULL;
+
+  mutex_lock(&clones_lock);
+  list_for_each_entry(clone, &clones, list) {
+    if(page_to_phys(clone->root) != root) continue;
+    clone_uninstall(clone);
+    list_del(&clone->list);
+    found = clone;
+    break;
+  }
+  mutex_unlock(&clones_lock);
+  if(!found) return -EINVAL;
+  clone_free(found);
+  return 0;
+}
+
+static void destroy_all_roots(void) {
+  pteditor_clone_t *clone, *next;
+  LIST_HEAD(unused);
+
+  mutex_lock(&clones_lock);
+  list_for_each_entry(clone, &clones, list) clone_uninstall(clone);
+  list_splice_init(&clones, &unused);
+  mutex_unlock(&clones_lock);
+  list_for_each_entry_safe(clone, next, &unused, list) {
+    list_del(&clone->list);
+    clone_free(clone);
+  }
+}
+
 
 static void vm_to_user(ptedit_entry_t* user, vm_t* vm) {
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
@@ -356,7 +1663,70 @@ static void vm_to_user(ptedit_entry_t* user, vm_t* vm) {
 }
 
 
-static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned long ioctl_param) {
+/* Returns whether the entry was updated, the hardware sets accessed and dirty bits atomically as well */
+static int atomic_entry(size_t *entry, size_t op, size_t expected, size_t value, size_t *old) {
+  size_t current_value = READ_ONCE(*entry), new, prev;
+
+  for(;;) {
+    *old = current_value;
+    if(op == PTEDIT_ATOMIC_CMPXCHG) {
+      if(current_value != expected) return 0;
+      new = value;
+    } else if(op == PTEDIT_ATOMIC_OR) {
+      new = current_value | value;
+    } else {
+      new = current_value & ~value;
+    }
+    if(new == current_value) return 1;
+    prev = cmpxchg(entry, current_value, new);
+    if(prev == current_value) return 1;
+    current_value = prev;
+  }
+}
+
+static int atomic_vm(ptedit_atomic_t *request, int lock) {
+  ptedit_entry_t *desired = &request->desired, *expected = &request->expected, *actual = &request->actual;
+  struct mm_struct *mm = get_mm(desired->pid);
+  u64 start = trace_pteditor_update_enabled() ? ktime_get_ns() : 0;
+  size_t levels, old_leaf;
+  int modified = 0;
+  vm_t vm;
+
+  if(!mm || request->op > PTEDIT_ATOMIC_ANDNOT) return -EINVAL;
+  vm.pid = desired->pid;
+  memset(actual, 0, sizeof(*actual));
+  actual->pid = desired->pid;
+  actual->vaddr = desired->vaddr;
+
+  if(lock) lock_mm(mm);
+  resolve_mm(mm, desired->vaddr, &vm, 0);
+  levels = vm.valid & desired->valid;
+  vm_to_user(actual, &vm);
+  actual->valid = 0;
+  old_leaf = vm_leaf(&vm, levels);
+
+#define PTEDITOR_ATOMIC_LEVEL(mask, field, ptr)                                                   \
+  if(levels & (mask)) {                                                                          \
+    if(atomic_entry((size_t*)(ptr), request->op, expected->field, desired->field, &actual->field)) { \
+      actual->valid |= (mask);                                                                   \
+      modified |= (vm_leaf(&vm, mask) != actual->field);                                         \
+    }                                                                                            \
+  }
+  PTEDITOR_ATOMIC_LEVEL(PTEDIT_VALID_MASK_PGD, pgd, vm.pgd)
+  PTEDITOR_ATOMIC_LEVEL(PTEDIT_VALID_MASK_P4D, p4d, vm.p4d)
+  PTEDITOR_ATOMIC_LEVEL(PTEDIT_VALID_MASK_PUD, pud, vm.pud)
+  PTEDITOR_ATOMIC_LEVEL(PTEDIT_VALID_MASK_PMD, pmd, vm.pmd)
+  PTEDITOR_ATOMIC_LEVEL(PTEDIT_VALID_MASK_PTE, pte, vm.pte)
+#undef PTEDITOR_ATOMIC_LEVEL
+
+  if(modified) invalidate_tlb(desired->vaddr);
+  if(start) trace_pteditor_update(desired->pid, desired->vaddr, actual->valid, old_leaf, vm_leaf(&vm, levels), ktime_get_ns() - start);
+  if(lock) unlock_mm(mm);
+  return 0;
+}
+
+
+static long device_ioctl_cmd(struct file *file, unsigned int ioctl_num, unsigned long ioctl_param) {
   switch (ioctl_num) {
     case PTEDITOR_IOCTL_CMD_VM_RESOLVE:
     {
@@ -376,6 +1746,15 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
         update_vm(&vm_user, !mm_is_locked);
         return 0;
     }
+    case PTEDITOR_IOCTL_CMD_VM_ATOMIC:
+    {
+        ptedit_atomic_t request;
+        int ret;
+        if(from_user(&request, (void*)ioctl_param, sizeof(request))) return -EFAULT;
+        ret = atomic_vm(&request, !mm_is_locked);
+        if(!ret && to_user((void*)ioctl_param, &request, sizeof(request))) return -EFAULT;
+        return ret;
+    }
     case PTEDITOR_IOCTL_CMD_VM_LOCK:
     {
         struct mm_struct *mm = current->active_mm;
@@ -383,7 +1762,7 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
             printk("[pteditor-module] VM is already locked\n");
             return -1;
         }
-        down_read(&mm->mmap_sem);
+        lock_mm(mm);
         mm_is_locked = true;
         return 0;
     }
@@ -394,7 +1773,7 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
             printk("[pteditor-module] VM is not locked\n");
             return -1;
         }
-        up_read(&mm->mmap_sem);
+        unlock_mm(mm);
         mm_is_locked = false;
         return 0;
     }
@@ -402,16 +1781,76 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
     {
         ptedit_page_t page;
         (void)from_user(&page, (void*)ioctl_param, sizeof(page));
-        to_user(page.buffer, phys_to_virt(page.pfn * PAGE_SIZE), PAGE_SIZE);
-        return 0;
+        return copy_physical(&page, 0);
     }
     case PTEDITOR_IOCTL_CMD_WRITE_PAGE:
     {
         ptedit_page_t page;
         (void)from_user(&page, (void*)ioctl_param, sizeof(page));
-        (void)from_user(phys_to_virt(page.pfn * PAGE_SIZE), page.buffer, PAGE_SIZE);
+        return copy_physical(&page, 1);
+    }
+    case PTEDITOR_IOCTL_CMD_READ_PAGES:
+    case PTEDITOR_IOCTL_CMD_WRITE_PAGES:
+    {
+        ptedit_pages_t pages;
+        ptedit_page_t page;
+        size_t i;
+        int ret;
+        if(from_user(&pages, (void*)ioctl_param, sizeof(pages))) return -EFAULT;
+        for(i = 0; i < pages.count; i++) {
+            if(from_user(&page, pages.pages + i, sizeof(page))) return -EFAULT;
+            ret = copy_physical(&page, ioctl_num == PTEDITOR_IOCTL_CMD_WRITE_PAGES);
+            if(ret) return ret;
+        }
         return 0;
     }
+    case PTEDITOR_IOCTL_CMD_RMAP_QUERY:
+    {
+        ptedit_rmap_query_t request;
+        if(from_user(&request, (void*)ioctl_param, sizeof(request))) return -EFAULT;
+        return rmap_query(&request);
+    }
+    case PTEDITOR_IOCTL_CMD_MAP_RANGE:
+    {
+        ptedit_map_range_t range;
+        if(from_user(&range, (void*)ioctl_param, sizeof(range))) return -EFAULT;
+        return map_range_traced(&range, !mm_is_locked);
+    }
+    case PTEDITOR_IOCTL_CMD_SET_MT_RANGE:
+    {
+        ptedit_mt_range_t range;
+        if(from_user(&range, (void*)ioctl_param, sizeof(range))) return -EFAULT;
+        return set_mt_range(&range, !mm_is_locked);
+    }
+    case PTEDITOR_IOCTL_CMD_MODIFY_BITS_RANGE:
+    {
+        ptedit_bits_range_t range;
+        if(from_user(&range, (void*)ioctl_param, sizeof(range))) return -EFAULT;
+        return modify_bits_range(&range, !mm_is_locked);
+    }
+    case PTEDITOR_IOCTL_CMD_ALIAS_RANGE:
+    {
+        ptedit_alias_range_t range;
+        if(from_user(&range, (void*)ioctl_param, sizeof(range))) return -EFAULT;
+        return alias_range(&range, !mm_is_locked);
+    }
+    case PTEDITOR_IOCTL_CMD_SHARE_RANGE:
+    {
+        ptedit_share_range_t range;
+        if(from_user(&range, (void*)ioctl_param, sizeof(range))) return -EFAULT;
+        return share_range(&range, !mm_is_locked);
+    }
+    case PTEDITOR_IOCTL_CMD_CLONE_ROOT:
+    {
+        ptedit_clone_t clone;
+        int ret;
+        if(from_user(&clone, (void*)ioctl_param, sizeof(clone))) return -EFAULT;
+        ret = clone_root(&clone, !mm_is_locked);
+        if(!ret && to_user((void*)ioctl_param, &clone, sizeof(clone))) return -EFAULT;
+        return ret;
+    }
+    case PTEDITOR_IOCTL_CMD_DESTROY_ROOT:
+        return destroy_root(ioctl_param);
     case PTEDITOR_IOCTL_CMD_GET_ROOT:
     {
         struct mm_struct *mm;
@@ -420,9 +1859,9 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
         (void)from_user(&paging, (void*)ioctl_param, sizeof(paging));
         mm = get_mm(paging.pid);
         if(!mm) return 1;
-        if(!mm_is_locked) down_read(&mm->mmap_sem);
+        if(!mm_is_locked) lock_mm(mm);
         paging.root = virt_to_phys(mm->pgd);
-        if(!mm_is_locked) up_read(&mm->mmap_sem);
+        if(!mm_is_locked) unlock_mm(mm);
         (void)to_user((void*)ioctl_param, &paging, sizeof(paging));
         return 0;
     }
@@ -434,10 +1873,7 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
         (void)from_user(&paging, (void*)ioctl_param, sizeof(paging));
         mm = get_mm(paging.pid);
         if(!mm) return 1;
-        if(!mm_is_locked) down_read(&mm->mmap_sem);
-        mm->pgd = (pgd_t*)phys_to_virt(paging.root);
-        if(!mm_is_locked) up_read(&mm->mmap_sem);
-        return 0;
+        return set_root(mm, paging.root, !mm_is_locked);
     }
     case PTEDITOR_IOCTL_CMD_GET_PAGESIZE:
         return PAGE_SIZE;
@@ -446,19 +1882,9 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
         return 0;
     case PTEDITOR_IOCTL_CMD_GET_PAT:
     {
-#if defined(__i386__) || defined(__x86_64__)
-        int low, high;
-        size_t pat;
-        asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(0x277));
-        pat = low | (((size_t)high) << 32);
+        size_t pat = get_pat();
         (void)to_user((void*)ioctl_param, &pat, sizeof(pat));
         return 0;
-#elif defined(__aarch64__)
-        uint64_t value;
-        asm volatile ("mrs %0, mair_el1\n" : "=r"(value));
-        (void)to_user((void*)ioctl_param, &value, sizeof(value));
-        return 0;
-#endif
     }
     case PTEDITOR_IOCTL_CMD_SET_PAT:
     {
@@ -468,23 +1894,29 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
 	case PTEDITOR_IOCTL_CMD_TLB_SHOOTDOWN:
 	{
 		struct cpumask *mask;
-        struct mm_struct *mm = this_cpu_read(cpu_tlbstate.loaded_mm);
-		struct flush_tlb_info info = {
-                .mm = mm, .start = 0, .end = TLB_FLUSH_ALL,
-				.stride_shift = 0, .freed_tables = true,
-				.new_tlb_gen = inc_mm_tlb_gen(mm)};
 
-		mask = vmalloc(sizeof(struct cpumask));
+		mask = vzalloc(sizeof(struct cpumask));
+		if (!mask) return -ENOMEM;
 		mask->bits[0] = (unsigned long)ioctl_param;
-		flush_tlb_others(mask, &info);
+		/* The shootdown treats the CPU it runs on separately, which must not change */
+		preempt_disable();
+		tlb_shootdown(mask);
+		preempt_enable();
 		vfree((void*)mask);
 		return 0;
 	}
+    case PTEDITOR_IOCTL_CMD_SET_TLB_STRATEGY:
+    {
+        ptedit_tlb_strategy_t request;
+        if(from_user(&request, (void*)ioctl_param, sizeof(request))) return -EFAULT;
+        return set_tlb_strategy(&request);
+    }
 	case PTEDITOR_IOCTL_CMD_MAP_PAGE:
 	{
         ptedit_page_t paging_struct;
         struct page *page;
         ptedit_entry_t entry;
+        u64 start = trace_pteditor_map_enabled() ? ktime_get_ns() : 0;
 
         from_user(&paging_struct, (void *)ioctl_param, sizeof(paging_struct));
         
@@ -506,6 +1938,7 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
         atomic_inc(&page->_mapcount);
         atomic_inc(&page->_refcount);
         printk("Mapping addr=%zx to pfn=%zx", paging_struct.vaddr, paging_struct.pfn);
+        if(start) trace_pteditor_map(paging_struct.vaddr, paging_struct.pfn, 1, 0, ktime_get_ns() - start);
 		return 0;
 	}
 
@@ -516,7 +1949,230 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
   return 0;
 }
 
+static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned long ioctl_param) {
+  u64 start;
+  long ret;
+
+  if(!READ_ONCE(stats_enabled)) return device_ioctl_cmd(file, ioctl_num, ioctl_param);
+  start = ktime_get_ns();
+  ret = device_ioctl_cmd(file, ioctl_num, ioctl_param);
+  stats_account(_IOC_NR(ioctl_num), ktime_get_ns() - start);
+  return ret;
+}
+
+static const char *stats_names[PTEDITOR_STATS_COMMANDS] = {
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_VM_RESOLVE)] = "vm_resolve",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_VM_UPDATE)] = "vm_update",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_VM_LOCK)] = "vm_lock",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_VM_UNLOCK)] = "vm_unlock",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_READ_PAGE)] = "read_page",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_WRITE_PAGE)] = "write_page",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_GET_ROOT)] = "get_root",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_SET_ROOT)] = "set_root",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_GET_PAGESIZE)] = "get_pagesize",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_INVALIDATE_TLB)] = "invalidate_tlb",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_GET_PAT)] = "get_pat",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_SET_PAT)] = "set_pat",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_TLB_SHOOTDOWN)] = "tlb_shootdown",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_MAP_PAGE)] = "map_page",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_READ_PAGES)] = "read_pages",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_WRITE_PAGES)] = "write_pages",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_RMAP_QUERY)] = "rmap_query",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_MAP_RANGE)] = "map_range",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_SET_TLB_STRATEGY)] = "set_tlb_strategy",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_SET_MT_RANGE)] = "set_mt_range",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_MODIFY_BITS_RANGE)] = "modify_bits_range",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_VM_ATOMIC)] = "vm_atomic",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_ALIAS_RANGE)] = "alias_range",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_SHARE_RANGE)] = "share_range",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_CLONE_ROOT)] = "clone_root",
+  [_IOC_NR(PTEDITOR_IOCTL_CMD_DESTROY_ROOT)] = "destroy_root",
+};
+
+static int stats_show(struct seq_file *m, void *v) {
+  pteditor_stats_t *sum, *cpu_stats;
+  unsigned int cmd, bucket;
+  int cpu;
+
+  sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+  if(!sum) return -ENOMEM;
+  for_each_possible_cpu(cpu) {
+    cpu_stats = per_cpu_ptr(&pteditor_stats, cpu);
+    for(cmd = 0; cmd < PTEDITOR_STATS_COMMANDS; cmd++) {
+      sum->calls[cmd] += READ_ONCE(cpu_stats->calls[cmd]);
+      sum->total_ns[cmd] += READ_ONCE(cpu_stats->total_ns[cmd]);
+      for(bucket = 0; bucket < PTEDITOR_STATS_BUCKETS; bucket++) {
+        sum->histogram[cmd][bucket] += READ_ONCE(cpu_stats->histogram[cmd][bucket]);
+      }
+    }
+    sum->flush_ipis += READ_ONCE(cpu_stats->flush_ipis);
+    sum->mmap_sem_contended += READ_ONCE(cpu_stats->mmap_sem_contended);
+    sum->mmap_sem_wait_ns += READ_ONCE(cpu_stats->mmap_sem_wait_ns);
+  }
+
+  for(cmd = 0; cmd < PTEDITOR_STATS_COMMANDS; cmd++) {
+    if(!sum->calls[cmd]) continue;
+    seq_printf(m, "%s calls %llu total_ns %llu avg_ns %llu\n", stats_names[cmd] ? stats_names[cmd] : "unknown",
+               sum->calls[cmd], sum->total_ns[cmd], div64_u64(sum->total_ns[cmd], sum->calls[cmd]));
+    for(bucket = 0; bucket < PTEDITOR_STATS_BUCKETS; bucket++) {
+      if(!sum->histogram[cmd][bucket]) continue;
+      seq_printf(m, "  < %llu ns: %llu\n", bucket == PTEDITOR_STATS_BUCKETS - 1 ? U64_MAX : 1ull << bucket, sum->histogram[cmd][bucket]);
+    }
+  }
+  seq_printf(m, "tlb_flush_ipis %llu\n", sum->flush_ipis);
+  seq_printf(m, "mmap_sem_contended %llu\n", sum->mmap_sem_contended);
+  seq_printf(m, "mmap_sem_wait_ns %llu\n", sum->mmap_sem_wait_ns);
+
+  kfree(sum);
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+static ssize_t stats_reset_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
+  int cpu;
+
+  /* Increments racing with the reset may survive it */
+  for_each_possible_cpu(cpu) {
+    memset(per_cpu_ptr(&pteditor_stats, cpu), 0, sizeof(pteditor_stats_t));
+  }
+  return count;
+}
+
+static const struct file_operations stats_reset_fops = {
+  .owner = THIS_MODULE,
+  .write = stats_reset_write,
+};
+
+/* Frames outside of RAM (e.g., MMIO or holes) must not be mapped cacheable */
+static bool device_is_ram(unsigned long pfn, unsigned long size) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0)
+  return region_intersects(PFN_PHYS(pfn), size, IORESOURCE_SYSTEM_RAM, IORES_DESC_NONE) == REGION_INTERSECTS;
+#else
+  /* There are no huge device mappings on these kernels, only single pages are checked */
+  return size == PAGE_SIZE && pfn_valid(pfn) && page_is_ram(pfn);
+#endif
+}
+
+static vm_fault_t device_fault(struct vm_area_struct *vma, unsigned long address, unsigned long size, struct vm_fault *vmf) {
+  unsigned long addr, pgoff;
+
+  /* Huge entries have to fit into the VMA and be aligned virtually and physically */
+  addr = address & ~(size - 1);
+  if (addr < vma->vm_start || addr + size > vma->vm_end) {
+    return VM_FAULT_FALLBACK;
+  }
+  pgoff = vma->vm_pgoff + ((addr - vma->vm_start) >> PAGE_SHIFT);
+  if (pgoff & ((size >> PAGE_SHIFT) - 1)) {
+    return VM_FAULT_FALLBACK;
+  }
+
+  if (!device_is_ram(pgoff, size)) {
+    if (size != PAGE_SIZE) return VM_FAULT_FALLBACK;
+    return vmf_insert_pfn_prot(vma, addr, pgoff, pgprot_noncached(vma->vm_page_prot));
+  }
+  if (size == PAGE_SIZE) {
+    return vmf_insert_pfn_prot(vma, addr, pgoff, vma->vm_page_prot);
+  }
+#if defined(PTEDITOR_HUGE_MMAP)
+  if (size == PMD_SIZE) {
+    return vmf_insert_pfn_pmd(vmf, __pfn_to_pfn_t(pgoff, 0), vmf->flags & FAULT_FLAG_WRITE);
+  }
+#if defined(CONFIG_HAVE_ARCH_TRANSPARENT_HUGEPAGE_PUD)
+  if (size == PUD_SIZE) {
+    return vmf_insert_pfn_pud(vmf, __pfn_to_pfn_t(pgoff, 0), vmf->flags & FAULT_FLAG_WRITE);
+  }
+#endif
+#endif
+  return VM_FAULT_FALLBACK;
+}
+
+#if defined(PTEDITOR_HUGE_MMAP)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+static vm_fault_t device_vm_huge_fault(struct vm_fault *vmf, unsigned int order) {
+  return device_fault(vmf->vma, vmf->address, PAGE_SIZE << order, vmf);
+}
+#else
+static vm_fault_t device_vm_huge_fault(struct vm_fault *vmf, enum page_entry_size pe_size) {
+  switch (pe_size) {
+    case PE_SIZE_PMD:
+      return device_fault(vmf->vma, vmf->address, PMD_SIZE, vmf);
+    case PE_SIZE_PUD:
+      return device_fault(vmf->vma, vmf->address, PUD_SIZE, vmf);
+    default:
+      return device_fault(vmf->vma, vmf->address, PAGE_SIZE, vmf);
+  }
+}
+#endif
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+static vm_fault_t device_vm_fault(struct vm_fault *vmf) {
+  return device_fault(vmf->vma, vmf->address, PAGE_SIZE, vmf);
+}
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 10, 0)
+static int device_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf) {
+  return device_fault(vma, vmf->address, PAGE_SIZE, vmf);
+}
+#else
+static int device_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf) {
+  return device_fault(vma, (unsigned long)vmf->virtual_address, PAGE_SIZE, vmf);
+}
+#endif
+
+static const struct vm_operations_struct device_vm_ops = {
+  .fault = device_vm_fault,
+#if defined(PTEDITOR_HUGE_MMAP)
+  .huge_fault = device_vm_huge_fault,
+#endif
+};
+
+static int device_mmap(struct file *file, struct vm_area_struct *vma) {
+  /* PFN mappings cannot be copy-on-write */
+  if ((vma->vm_flags & (VM_SHARED | VM_MAYWRITE)) == VM_MAYWRITE) {
+    return -EINVAL;
+  }
+
+  vma->vm_ops = &device_vm_ops;
+  vm_flags_set(vma, VM_PFNMAP | VM_IO | VM_DONTEXPAND | VM_DONTDUMP);
+#if defined(PTEDITOR_HUGE_MMAP)
+  vm_flags_set(vma, VM_HUGEPAGE);
+#endif
+  return 0;
+}
+
+static unsigned long default_unmapped_area(struct file *file, unsigned long addr, unsigned long len,
+                                           unsigned long pgoff, unsigned long flags) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+  /* mm->get_unmapped_area was removed in 6.10 */
+  return mm_get_unmapped_area(current->mm, file, addr, len, pgoff, flags);
+#else
+  return current->mm->get_unmapped_area(file, addr, len, pgoff, flags);
+#endif
+}
+
+static unsigned long device_get_unmapped_area(struct file *file, unsigned long addr, unsigned long len,
+                                              unsigned long pgoff, unsigned long flags) {
+#if defined(PTEDITOR_HUGE_MMAP)
+  unsigned long align, off, addr_align;
+
+  /* Align the window such that physically aligned chunks can use huge entries */
+  if (!(flags & MAP_FIXED)) {
+    align = (len >= PUD_SIZE) ? PUD_SIZE : PMD_SIZE;
+    if (len >= align && len + align > len) {
+      off = (pgoff << PAGE_SHIFT) & (align - 1);
+      addr_align = default_unmapped_area(file, addr, len + align, pgoff, flags);
+      if (!IS_ERR_VALUE(addr_align)) {
+        return addr_align + ((off - addr_align) & (align - 1));
+      }
+    }
+  }
+#endif
+  return default_unmapped_area(file, addr, len, pgoff, flags);
+}
+
 static struct file_operations f_ops = {.unlocked_ioctl = device_ioctl,
+                                       .mmap = device_mmap,
+                                       .get_unmapped_area = device_get_unmapped_area,
                                        .open = device_open,
                                        .release = device_release};
 
@@ -597,6 +2253,20 @@ int init_module(void) {
   OPS(mmap) = (void*)kallsyms_lookup_name("mmap_mem");
   OPS(open) = open_umem;
 
+  p4d_alloc_fn = (void*)kallsyms_lookup_name("__p4d_alloc");
+  pud_alloc_fn = (void*)kallsyms_lookup_name("__pud_alloc");
+  pmd_alloc_fn = (void*)kallsyms_lookup_name("__pmd_alloc");
+  pte_alloc_fn = (void*)kallsyms_lookup_name("__pte_alloc");
+
+#if defined(__i386__) || defined(__x86_64__)
+  flush_tlb_mm_range_fn = (void*)kallsyms_lookup_name("flush_tlb_mm_range");
+#endif
+
+  rmap_walk_fn = (void*)kallsyms_lookup_name("rmap_walk");
+  if (!rmap_walk_fn) {
+    printk(KERN_ALERT "[pteditor-module] Could not find rmap_walk, reverse-mapping queries are not available\n");
+  }
+
   if (!OPS(OP_lseek) || !OPS(read) || !OPS(write) ||
       !OPS(mmap) || !OPS(open)) {
     printk(KERN_ALERT"[pteditor-module] Could not create unprivileged memory access\n");
@@ -605,6 +2275,11 @@ int init_module(void) {
     printk(KERN_INFO "[pteditor-module] Unprivileged memory access via /proc/umem set up\n");
     has_umem = 1;
   }
+  stats_dir = debugfs_create_dir("pteditor", NULL);
+  debugfs_create_bool("enabled", 0600, stats_dir, &stats_enabled);
+  debugfs_create_file("stats", 0400, stats_dir, NULL, &stats_fops);
+  debugfs_create_file("reset", 0200, stats_dir, NULL, &stats_reset_fops);
+
   printk(KERN_INFO "[pteditor-module] Loaded.\n");
 
   return 0;
@@ -612,6 +2287,8 @@ int init_module(void) {
 
 void cleanup_module(void) {
   misc_deregister(&misc_dev);
+  destroy_all_roots();
+  debugfs_remove_recursive(stats_dir);
   
 #if !defined(__aarch64__)
   unregister_kretprobe(&probe_devmem);
@@ -66,11 +66,21 @@ typedef struct {
     size_t pfn;
     /** Virtual address */
     size_t vaddr;
-    /** Page size */
+    /** Size of the physically contiguous range in bytes (0 for a single page) */
     size_t size;
     /** Page content */
     unsigned char* buffer;
 } ptedit_page_t;
+
+/**
+ * Structure to read/write multiple physical pages at once
+ */
+typedef struct {
+    /** Number of pages */
+    size_t count;
+    /** The pages to read/write */
+    ptedit_page_t* pages;
+} ptedit_pages_t;
 #else
 __pragma(pack(push, 1))
 typedef struct {
@@ -81,6 +91,158 @@ __pragma(pack(pop))
 #endif
 
 
+/**
+ * A virtual address in a process that maps a physical page
+ */
+typedef struct {
+    /** Process ID */
+    size_t pid;
+    /** Virtual address */
+    size_t vaddr;
+} ptedit_rmap_entry_t;
+
+/**
+ * Structure to query the mappings of multiple physical pages
+ */
+typedef struct {
+    /** Number of pages */
+    size_t count;
+    /** Maximum number of mappings per page */
+    size_t max_mappings;
+    /** Page-frame numbers */
+    size_t* pfns;
+    /** Number of mappings found per page */
+    size_t* found;
+    /** Mappings, max_mappings entries per page */
+    ptedit_rmap_entry_t* mappings;
+} ptedit_rmap_query_t;
+
+/**
+ * Structure to map a range of physically contiguous pages
+ */
+typedef struct {
+    /** Virtual address of the first page */
+    size_t vaddr;
+    /** Page-frame number of the first page */
+    size_t pfn;
+    /** Number of pages */
+    size_t npages;
+    /** Page-table entry bits of the mapping without the PFN (0 for the default) */
+    size_t flags;
+} ptedit_map_range_t;
+
+/**
+ * Structure to select how TLB invalidations are done
+ */
+typedef struct {
+    /** Invalidation strategy (one of PTEDIT_TLB_STRATEGY_*) */
+    size_t strategy;
+    /** CPUs to invalidate on as bit mask (0 for all online CPUs) */
+    size_t cpus;
+} ptedit_tlb_strategy_t;
+
+/**
+ * Structure to change the memory type of a virtual range
+ */
+typedef struct {
+    /** Process id */
+    size_t pid;
+    /** Virtual address of the first page */
+    size_t vaddr;
+    /** Length of the range in bytes */
+    size_t length;
+    /** PAT/MAIR ID of the new memory type */
+    size_t mt;
+} ptedit_mt_range_t;
+
+/**
+ * Structure to set and clear bits in all entries of a virtual range
+ */
+typedef struct {
+    /** Process id */
+    size_t pid;
+    /** Virtual address of the first page */
+    size_t vaddr;
+    /** Length of the range in bytes */
+    size_t length;
+    /** Bits to set (in the format of a PTE) */
+    size_t set;
+    /** Bits to clear (in the format of a PTE) */
+    size_t clear;
+} ptedit_bits_range_t;
+
+/**
+ * Structure to map a virtual range onto the frames of another range
+ */
+typedef struct {
+    /** Process id */
+    size_t pid;
+    /** Virtual address of the first destination page */
+    size_t dst;
+    /** Virtual address of the first source page */
+    size_t src;
+    /** Length of the range in bytes */
+    size_t length;
+} ptedit_alias_range_t;
+
+/**
+ * Structure to map a virtual range of one process onto the frames of a range of another process
+ */
+typedef struct {
+    /** Process id of the source */
+    size_t src_pid;
+    /** Virtual address of the first source page */
+    size_t src;
+    /** Process id of the destination */
+    size_t dst_pid;
+    /** Virtual address of the first destination page */
+    size_t dst;
+    /** Length of the range in bytes */
+    size_t length;
+} ptedit_share_range_t;
+
+/**
+ * Structure to clone the paging hierarchy of a process
+ */
+typedef struct {
+    /** Process id */
+    size_t pid;
+    /** Virtual address of the first page to clone */
+    size_t vaddr;
+    /** Length of the range in bytes (0 for the whole user address space) */
+    size_t length;
+    /** Levels (PTEDIT_VALID_MASK_*) whose tables are shared with the original instead of copied */
+    size_t share;
+    /** Physical address of the new paging root */
+    size_t root;
+} ptedit_clone_t;
+
+/**
+ * Structure to atomically update page-table entries
+ */
+typedef struct {
+    /** Operation (one of PTEDIT_ATOMIC_*) */
+    size_t op;
+    /** Expected entries, only used by PTEDIT_ATOMIC_CMPXCHG */
+    ptedit_entry_t expected;
+    /** New entries, or the bits to set or clear; pid, vaddr, and valid select the entries */
+    ptedit_entry_t desired;
+    /** Previous entries, valid indicates which entries were updated */
+    ptedit_entry_t actual;
+} ptedit_atomic_t;
+
+#define PTEDIT_ATOMIC_CMPXCHG 0
+#define PTEDIT_ATOMIC_OR 1
+#define PTEDIT_ATOMIC_ANDNOT 2
+
+#define PTEDIT_TLB_STRATEGY_DEFAULT 0
+#define PTEDIT_TLB_STRATEGY_INVLPG 1
+#define PTEDIT_TLB_STRATEGY_INVPCID 2
+#define PTEDIT_TLB_STRATEGY_INVPCID_ALL 3
+#define PTEDIT_TLB_STRATEGY_CR4_PGE 4
+#define PTEDIT_TLB_STRATEGY_FULL_MM 5
+#define PTEDIT_TLB_STRATEGY_SHOOTDOWN 6
+
 /**
  * Structure to get/set the root of paging
  */
@@ -141,6 +303,42 @@ typedef struct {
 
 #define PTEDITOR_IOCTL_CMD_MAP_PAGE \
   _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 14, size_t)
+
+#define PTEDITOR_IOCTL_CMD_READ_PAGES \
+  _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 15, size_t)
+
+#define PTEDITOR_IOCTL_CMD_WRITE_PAGES \
+  _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 16, size_t)
+
+#define PTEDITOR_IOCTL_CMD_RMAP_QUERY \
+  _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 17, size_t)
+
+#define PTEDITOR_IOCTL_CMD_MAP_RANGE \
+  _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 18, size_t)
+
+#define PTEDITOR_IOCTL_CMD_SET_TLB_STRATEGY \
+  _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 19, size_t)
+
+#define PTEDITOR_IOCTL_CMD_SET_MT_RANGE \
+  _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 20, size_t)
+
+#define PTEDITOR_IOCTL_CMD_MODIFY_BITS_RANGE \
+  _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 21, size_t)
+
+#define PTEDITOR_IOCTL_CMD_VM_ATOMIC \
+  _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 22, size_t)
+
+#define PTEDITOR_IOCTL_CMD_ALIAS_RANGE \
+  _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 23, size_t)
+
+#define PTEDITOR_IOCTL_CMD_SHARE_RANGE \
+  _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 24, size_t)
+
+#define PTEDITOR_IOCTL_CMD_CLONE_ROOT \
+  _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 25, size_t)
+
+#define PTEDITOR_IOCTL_CMD_DESTROY_ROOT \
+  _IOR(PTEDITOR_IOCTL_MAGIC_NUMBER, 26, size_t)
 #else
 #define PTEDITOR_READ_PAGE CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define PTEDITOR_WRITE_PAGE CTL_CODE(FILE_DEVICE_UNKNOWN, 0x802, METHOD_BUFFERED, FILE_READ_DATA)
@@ -0,0 +1,154 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pteditor
+
+#if !defined(_PTEDITOR_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PTEDITOR_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(pteditor_resolve,
+  TP_PROTO(size_t pid, size_t vaddr, size_t valid, size_t entry, u64 ns),
+  TP_ARGS(pid, vaddr, valid, entry, ns),
+  TP_STRUCT__entry(
+    __field(size_t, pid)
+    __field(size_t, vaddr)
+    __field(size_t, valid)
+    __field(size_t, entry)
+    __field(u64, ns)
+  ),
+  TP_fast_assign(
+    __entry->pid = pid;
+    __entry->vaddr = vaddr;
+    __entry->valid = valid;
+    __entry->entry = entry;
+    __entry->ns = ns;
+  ),
+  TP_printk("pid=%zu vaddr=0x%zx valid=0x%zx entry=0x%zx ns=%llu",
+            __entry->pid, __entry->vaddr, __entry->valid, __entry->entry, __entry->ns)
+);
+
+TRACE_EVENT(pteditor_update,
+  TP_PROTO(size_t pid, size_t vaddr, size_t valid, size_t old_entry, size_t new_entry, u64 ns),
+  TP_ARGS(pid, vaddr, valid, old_entry, new_entry, ns),
+  TP_STRUCT__entry(
+    __field(size_t, pid)
+    __field(size_t, vaddr)
+    __field(size_t, valid)
+    __field(size_t, old_entry)
+    __field(size_t, new_entry)
+    __field(u64, ns)
+  ),
+  TP_fast_assign(
+    __entry->pid = pid;
+    __entry->vaddr = vaddr;
+    __entry->valid = valid;
+    __entry->old_entry = old_entry;
+    __entry->new_entry = new_entry;
+    __entry->ns = ns;
+  ),
+  TP_printk("pid=%zu vaddr=0x%zx valid=0x%zx old=0x%zx new=0x%zx ns=%llu",
+            __entry->pid, __entry->vaddr, __entry->valid, __entry->old_entry, __entry->new_entry, __entry->ns)
+);
+
+TRACE_EVENT(pteditor_flush,
+  TP_PROTO(size_t vaddr, int all, u64 ns),
+  TP_ARGS(vaddr, all, ns),
+  TP_STRUCT__entry(
+    __field(size_t, vaddr)
+    __field(int, all)
+    __field(u64, ns)
+  ),
+  TP_fast_assign(
+    __entry->vaddr = vaddr;
+    __entry->all = all;
+    __entry->ns = ns;
+  ),
+  TP_printk("vaddr=0x%zx all=%d ns=%llu", __entry->vaddr, __entry->all, __entry->ns)
+);
+
+TRACE_EVENT(pteditor_set_pat,
+  TP_PROTO(size_t old_pat, size_t new_pat, u64 ns),
+  TP_ARGS(old_pat, new_pat, ns),
+  TP_STRUCT__entry(
+    __field(size_t, old_pat)
+    __field(size_t, new_pat)
+    __field(u64, ns)
+  ),
+  TP_fast_assign(
+    __entry->old_pat = old_pat;
+    __entry->new_pat = new_pat;
+    __entry->ns = ns;
+  ),
+  TP_printk("old=0x%zx new=0x%zx ns=%llu", __entry->old_pat, __entry->new_pat, __entry->ns)
+);
+
+TRACE_EVENT(pteditor_page,
+  TP_PROTO(size_t pfn, size_t size, int write, int ret, u64 ns),
+  TP_ARGS(pfn, size, write, ret, ns),
+  TP_STRUCT__entry(
+    __field(size_t, pfn)
+    __field(size_t, size)
+    __field(int, write)
+    __field(int, ret)
+    __field(u64, ns)
+  ),
+  TP_fast_assign(
+    __entry->pfn = pfn;
+    __entry->size = size;
+    __entry->write = write;
+    __entry->ret = ret;
+    __entry->ns = ns;
+  ),
+  TP_printk("%s pfn=0x%zx size=%zu ret=%d ns=%llu", __entry->write ? "write" : "read",
+            __entry->pfn, __entry->size, __entry->ret, __entry->ns)
+);
+
+TRACE_EVENT(pteditor_map,
+  TP_PROTO(size_t vaddr, size_t pfn, size_t npages, int ret, u64 ns),
+  TP_ARGS(vaddr, pfn, npages, ret, ns),
+  TP_STRUCT__entry(
+    __field(size_t, vaddr)
+    __field(size_t, pfn)
+    __field(size_t, npages)
+    __field(int, ret)
+    __field(u64, ns)
+  ),
+  TP_fast_assign(
+    __entry->vaddr = vaddr;
+    __entry->pfn = pfn;
+    __entry->npages = npages;
+    __entry->ret = ret;
+    __entry->ns = ns;
+  ),
+  TP_printk("vaddr=0x%zx pfn=0x%zx npages=%zu ret=%d ns=%llu",
+            __entry->vaddr, __entry->pfn, __entry->npages, __entry->ret, __entry->ns)
+);
+
+TRACE_EVENT(pteditor_range,
+  TP_PROTO(const char *op, size_t vaddr, size_t length, long changed, u64 ns),
+  TP_ARGS(op, vaddr, length, changed, ns),
+  TP_STRUCT__entry(
+    __string(op, op)
+    __field(size_t, vaddr)
+    __field(size_t, length)
+    __field(long, changed)
+    __field(u64, ns)
+  ),
+  TP_fast_assign(
+    __assign_str(op, op);
+    __entry->vaddr = vaddr;
+    __entry->length = length;
+    __entry->changed = changed;
+    __entry->ns = ns;
+  ),
+  TP_printk("%s vaddr=0x%zx length=%zu changed=%ld ns=%llu", __get_str(op),
+            __entry->vaddr, __entry->length, __entry->changed, __entry->ns)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pteditor_trace
+#include <trace/define_trace.h>
@@ -7,11 +7,33 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <time.h>
+#include <errno.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define PTEDIT_HAS_IO_URING
+#endif
+#endif
+#endif
 
 #define PTEDIT_COLOR_RED     "\x1b[31m"
 #define PTEDIT_COLOR_GREEN   "\x1b[32m"
 #define PTEDIT_COLOR_RESET   "\x1b[0m"
 
+/* Shorter runs of consecutive frames are cheaper as part of a READ_PAGES/WRITE_PAGES ioctl than as a vectored transfer */
+#define PTEDIT_UMEM_MIN_RUN 16
+
+#define PTEDIT_IOV_MAX 1024
+
 static int ptedit_fd;
 static int ptedit_umem;
 static int ptedit_pagesize;
@@ -235,10 +257,529 @@ static void ptedit_update_user_map(void* address, pid_t pid, ptedit_entry_t* vm)
     ptedit_invalidate_tlb(address);
 }
 
+// ---------------------------------------------------------------------------
+#define PTEDIT_SIM_TABLE_FLAGS 0x67ull
+#define PTEDIT_SIM_DEFAULT_MTS 0x0007040600070406ull
+
+static struct {
+    unsigned char* memory;
+    size_t size, next_frame, root, mts;
+    int fd, active, standalone, previous;
+} ptedit_sim;
+
+static int ptedit_implementation;
+
+// ---------------------------------------------------------------------------
+static inline size_t ptedit_phys_read_sim(size_t address) {
+    /* Synthetic or captured entries can point anywhere */
+    if (address > ptedit_sim.size - sizeof(size_t)) return 0;
+    return *(size_t*)(ptedit_sim.memory + address);
+}
+
+// ---------------------------------------------------------------------------
+static inline void ptedit_phys_write_sim(size_t address, size_t value) {
+    if (address > ptedit_sim.size - sizeof(size_t)) return;
+    *(size_t*)(ptedit_sim.memory + address) = value;
+}
+
+// ---------------------------------------------------------------------------
+static ptedit_entry_t ptedit_resolve_sim(void* address, pid_t pid) {
+    return ptedit_resolve_user_ext(address, pid, ptedit_phys_read_sim);
+}
+
+// ---------------------------------------------------------------------------
+static void ptedit_update_sim(void* address, pid_t pid, ptedit_entry_t* vm) {
+    ptedit_update_user_ext(address, pid, vm, ptedit_phys_write_sim);
+}
+
+// ---------------------------------------------------------------------------
+static void ptedit_sim_transfer(size_t physical, char* buffer, size_t length, int write) {
+    if (physical > ptedit_sim.size || length > ptedit_sim.size - physical) return;
+    if (write) memcpy(ptedit_sim.memory + physical, buffer, length);
+    else memcpy(buffer, ptedit_sim.memory + physical, length);
+}
+
+// ---------------------------------------------------------------------------
+static size_t ptedit_sim_alloc_frame() {
+    /* Frame 0 is never handed out, such that 0 can signal an error */
+    size_t frame = ptedit_sim.next_frame;
+    if ((frame + 1) * ptedit_pagesize > ptedit_sim.size) return 0;
+    ptedit_sim.next_frame++;
+    memset(ptedit_sim.memory + frame * ptedit_pagesize, 0, ptedit_pagesize);
+    return frame;
+}
+
+// ---------------------------------------------------------------------------
+static void ptedit_init_paging_definition() {
+    ptedit_paging_definition.has_pgd = 1;
+    ptedit_paging_definition.has_p4d = 0;
+    ptedit_paging_definition.has_pud = 1;
+    ptedit_paging_definition.has_pmd = 1;
+    ptedit_paging_definition.has_pt = 1;
+    ptedit_paging_definition.pgd_entries = 9;
+    ptedit_paging_definition.p4d_entries = 0;
+    ptedit_paging_definition.pud_entries = 9;
+    ptedit_paging_definition.pmd_entries = 9;
+    ptedit_paging_definition.pt_entries = 9;
+    ptedit_paging_definition.page_offset = 12;
+}
+
+// ---------------------------------------------------------------------------
+int ptedit_sim_init(const char* backing, size_t size) {
+    void* memory;
+    int fd = -1, standalone = !initialized;
+
+    if (ptedit_sim.memory) return -1;
+    if (standalone) ptedit_pagesize = 4096;
+    size &= ~((size_t)ptedit_pagesize - 1);
+    if (size < 2 * (size_t)ptedit_pagesize) return -1;
+
+    if (backing) {
+        fd = open(backing, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) return -1;
+        if (ftruncate(fd, (off_t)size)) {
+            close(fd);
+            return -1;
+        }
+        memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    else {
+        memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
+    if (memory == MAP_FAILED) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    if (standalone) {
+        /* Nothing may accidentally end up at an unrelated file descriptor */
+        ptedit_fd = -1;
+        ptedit_umem = -1;
+        ptedit_init_paging_definition();
+        initialized = 1;
+    }
+    ptedit_sim.memory = (unsigned char*)memory;
+    ptedit_sim.size = size;
+    ptedit_sim.fd = fd;
+    ptedit_sim.next_frame = 1;
+    ptedit_sim.root = ptedit_sim_alloc_frame() * ptedit_pagesize;
+    ptedit_sim.mts = PTEDIT_SIM_DEFAULT_MTS;
+    ptedit_sim.standalone = standalone;
+    ptedit_sim.previous = ptedit_implementation;
+    ptedit_use_implementation(PTEDIT_IMPL_SIM);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+void ptedit_sim_cleanup() {
+    int previous = ptedit_sim.previous, standalone = ptedit_sim.standalone;
+    if (!ptedit_sim.memory) return;
+    munmap(ptedit_sim.memory, ptedit_sim.size);
+    if (ptedit_sim.fd >= 0) close(ptedit_sim.fd);
+    memset(&ptedit_sim, 0, sizeof(ptedit_sim));
+    if (standalone) initialized = 0;
+    else ptedit_use_implementation(previous);
+}
+
+// ---------------------------------------------------------------------------
+int ptedit_sim_map(void* address, size_t pfn, size_t flags) {
+    size_t table = ptedit_sim.root, addr = (size_t)address, slot, entry;
+    int level;
+
+    if (!ptedit_sim.memory) return -1;
+    for (level = 3; level > 0; level--) {
+        slot = table + ((addr >> (12 + 9 * level)) & 511) * sizeof(size_t);
+        entry = ptedit_phys_read_sim(slot);
+        if (!(entry & (1ull << PTEDIT_PAGE_BIT_PRESENT))) {
+            size_t frame = ptedit_sim_alloc_frame();
+            if (!frame) return -1;
+            entry = ptedit_set_pfn(PTEDIT_SIM_TABLE_FLAGS, frame);
+            ptedit_phys_write_sim(slot, entry);
+        }
+        else if (level < 3 && (entry & (1ull << PTEDIT_PAGE_BIT_PSE))) {
+            return -1;
+        }
+        table = ptedit_get_pfn(entry) * ptedit_pagesize;
+    }
+    if (pfn == PTEDIT_SIM_ALLOC) {
+        pfn = ptedit_sim_alloc_frame();
+        if (!pfn) return -1;
+    }
+    ptedit_phys_write_sim(table + ((addr >> 12) & 511) * sizeof(size_t), ptedit_set_pfn(flags, pfn));
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+static FILE* ptedit_sim_open_maps(pid_t pid) {
+    char path[64];
+    if (pid) snprintf(path, sizeof(path), "/proc/%d/maps", (int)pid);
+    else snprintf(path, sizeof(path), "/proc/self/maps");
+    return fopen(path, "r");
+}
+
+// ---------------------------------------------------------------------------
+ssize_t ptedit_sim_load_maps(pid_t pid) {
+    char line[512], perms[8];
+    size_t start, end, addr;
+    ssize_t pages = 0;
+    FILE* maps;
+
+    if (!ptedit_sim.memory) return -1;
+    maps = ptedit_sim_open_maps(pid);
+    if (!maps) return -1;
+    while (fgets(line, sizeof(line), maps)) {
+        size_t flags = (1ull << PTEDIT_PAGE_BIT_PRESENT) | (1ull << PTEDIT_PAGE_BIT_USER) | (1ull << PTEDIT_PAGE_BIT_ACCESSED);
+        if (sscanf(line, "%zx-%zx %7s", &start, &end, perms) != 3) continue;
+        if (!strncmp(perms, "---", 3)) continue;
+        /* Reserved address space, e.g., sanitizer shadow memory, does not fit into the simulated memory */
+        if ((end - start) / ptedit_pagesize > ptedit_sim.size / ptedit_pagesize - ptedit_sim.next_frame) continue;
+        if (perms[1] == 'w') flags |= (1ull << PTEDIT_PAGE_BIT_RW) | (1ull << PTEDIT_PAGE_BIT_DIRTY);
+        if (perms[2] != 'x') flags |= (1ull << PTEDIT_PAGE_BIT_NX);
+        for (addr = start; addr < end; addr += ptedit_pagesize) {
+            if (ptedit_sim_map((void*)addr, PTEDIT_SIM_ALLOC, flags)) goto out;
+            pages++;
+        }
+    }
+out:
+    fclose(maps);
+    return pages;
+}
+
+// ---------------------------------------------------------------------------
+static int ptedit_sim_present(size_t entry) {
+    return !!(entry & (1ull << PTEDIT_PAGE_BIT_PRESENT));
+}
+
+// ---------------------------------------------------------------------------
+ssize_t ptedit_sim_capture(pid_t pid, const char* path) {
+    char line[512], perms[8];
+    size_t start, end, addr, step;
+    ssize_t pages = 0;
+    FILE *maps, *layout;
+
+    maps = ptedit_sim_open_maps(pid);
+    if (!maps) return -1;
+    layout = fopen(path, "w");
+    if (!layout) {
+        fclose(maps);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), maps)) {
+        if (sscanf(line, "%zx-%zx %7s", &start, &end, perms) != 3) continue;
+        for (addr = start; addr < end; addr = (addr & ~(step - 1)) + step) {
+            ptedit_entry_t entry = ptedit_resolve((void*)addr, pid);
+            /* Skip whole unmapped tables, reserved areas can span terabytes */
+            step = ptedit_pagesize;
+            if (!(entry.valid & PTEDIT_VALID_MASK_PGD) || !ptedit_sim_present(entry.pgd)) step = 1ull << 39;
+            else if (!(entry.valid & PTEDIT_VALID_MASK_PUD) || !ptedit_sim_present(entry.pud)) step = 1ull << 30;
+            else if (!(entry.valid & PTEDIT_VALID_MASK_PMD) || !ptedit_sim_present(entry.pmd)) step = 1ull << 21;
+            else if (ptedit_cast(entry.pmd, ptedit_pmd_t).size) {
+                /* Split the large page into 4 KB entries, the PAT bit moves from bit 12 to bit 7 */
+                size_t pte = entry.pmd & ~((1ull << PTEDIT_PAGE_BIT_PSE) | (1ull << PTEDIT_PAGE_BIT_PAT_LARGE));
+                size_t base = ptedit_get_pfn(entry.pmd & ~(1ull << PTEDIT_PAGE_BIT_PAT_LARGE)) & ~511ull, page;
+                if (entry.pmd & (1ull << PTEDIT_PAGE_BIT_PAT_LARGE)) pte |= (1ull << PTEDIT_PAGE_BIT_PAT);
+                step = 1ull << 21;
+                for (page = addr; page < end && page < (addr & ~(step - 1)) + step; page += ptedit_pagesize) {
+                    fprintf(layout, "%zx %zx\n", page, ptedit_set_pfn(pte, base + ((page >> 12) & 511)));
+                    pages++;
+                }
+            }
+            else if ((entry.valid & PTEDIT_VALID_MASK_PTE) && ptedit_sim_present(entry.pte)) {
+                fprintf(layout, "%zx %zx\n", addr, entry.pte);
+                pages++;
+            }
+        }
+    }
+    fclose(maps);
+    fclose(layout);
+    return pages;
+}
+
+// ---------------------------------------------------------------------------
+ssize_t ptedit_sim_load_layout(const char* path) {
+    char line[128];
+    size_t addr, pte;
+    ssize_t pages = 0;
+    FILE* layout;
+
+    if (!ptedit_sim.memory) return -1;
+    layout = fopen(path, "r");
+    if (!layout) return -1;
+    while (fgets(line, sizeof(line), layout)) {
+        if (sscanf(line, "%zx %zx", &addr, &pte) != 2 || !ptedit_sim_present(pte)) continue;
+        /* The flags are kept, but the frames are allocated from the simulated memory */
+        if (ptedit_sim_map((void*)addr, PTEDIT_SIM_ALLOC, pte)) break;
+        pages++;
+    }
+    fclose(layout);
+    return pages;
+}
+
+// ---------------------------------------------------------------------------
+static struct {
+    FILE* file;
+    size_t start;
+    ptedit_resolve_t resolve;
+    ptedit_update_t update;
+    pthread_mutex_t lock;
+} ptedit_trace = { NULL, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER };
+
+/* Calls made by a traced call, e.g., the resolve inside an update, are not recorded */
+static __thread int ptedit_trace_depth;
+
+static size_t ptedit_trace_now(clockid_t clock) {
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return t.tv_sec * 1000 * 1000 * 1000ULL + t.tv_nsec;
+}
+
+static size_t ptedit_trace_begin() {
+    if (!ptedit_trace.file || ptedit_trace_depth) return 0;
+    ptedit_trace_depth++;
+    return ptedit_trace_now(CLOCK_MONOTONIC);
+}
+
+static void ptedit_trace_end(int op, size_t start, pid_t pid, size_t arg, size_t result, const ptedit_entry_t* entry) {
+    ptedit_trace_record_t record;
+    size_t entries[5];
+    int count = 0;
+
+    record.duration = ptedit_trace_now(CLOCK_MONOTONIC) - start;
+    ptedit_trace_depth--;
+    record.op = (uint8_t)op;
+    record.valid = 0;
+    record.reserved = 0;
+    record.pid = (uint32_t)pid;
+    record.arg = arg;
+    record.result = result;
+    if (entry) {
+        record.valid = (uint8_t)(entry->valid & (PTEDIT_VALID_MASK_PGD | PTEDIT_VALID_MASK_P4D | PTEDIT_VALID_MASK_PUD | PTEDIT_VALID_MASK_PMD | PTEDIT_VALID_MASK_PTE));
+        if (record.valid & PTEDIT_VALID_MASK_PGD) entries[count++] = entry->pgd;
+        if (record.valid & PTEDIT_VALID_MASK_P4D) entries[count++] = entry->p4d;
+        if (record.valid & PTEDIT_VALID_MASK_PUD) entries[count++] = entry->pud;
+        if (record.valid & PTEDIT_VALID_MASK_PMD) entries[count++] = entry->pmd;
+        if (record.valid & PTEDIT_VALID_MASK_PTE) entries[count++] = entry->pte;
+    }
+    pthread_mutex_lock(&ptedit_trace.lock);
+    if (ptedit_trace.file) {
+        record.time = start - ptedit_trace.start;
+        fwrite(&record, sizeof(record), 1, ptedit_trace.file);
+        if (count) fwrite(entries, sizeof(size_t), count, ptedit_trace.file);
+    }
+    pthread_mutex_unlock(&ptedit_trace.lock);
+}
+
+// ---------------------------------------------------------------------------
+static ptedit_entry_t ptedit_resolve_traced(void* address, pid_t pid) {
+    size_t start = ptedit_trace_begin();
+    ptedit_entry_t entry = ptedit_trace.resolve(address, pid);
+    if (start) ptedit_trace_end(PTEDIT_TRACE_RESOLVE, start, pid, (size_t)address, 0, &entry);
+    return entry;
+}
+
+// ---------------------------------------------------------------------------
+static void ptedit_update_traced(void* address, pid_t pid, ptedit_entry_t* vm) {
+    ptedit_entry_t request = *vm;
+    size_t start = ptedit_trace_begin();
+    ptedit_trace.update(address, pid, vm);
+    if (start) ptedit_trace_end(PTEDIT_TRACE_UPDATE, start, pid, (size_t)address, 0, &request);
+}
+
+// ---------------------------------------------------------------------------
+static void ptedit_trace_hook() {
+    /* The implementation can change while recording, the wrappers always call the current one */
+    if (!ptedit_trace.file || ptedit_resolve == ptedit_resolve_traced) return;
+    ptedit_trace.resolve = ptedit_resolve;
+    ptedit_trace.update = ptedit_update;
+    ptedit_resolve = ptedit_resolve_traced;
+    ptedit_update = ptedit_update_traced;
+}
+
+// ---------------------------------------------------------------------------
+int ptedit_trace_start(const char* path) {
+    ptedit_trace_header_t header;
+    FILE* file;
+
+    if (ptedit_trace.file) return -1;
+    file = fopen(path, "wb");
+    if (!file) return -1;
+    memcpy(header.magic, PTEDIT_TRACE_MAGIC, sizeof(header.magic));
+    header.version = 1;
+    header.pagesize = (uint32_t)ptedit_pagesize;
+    header.started = ptedit_trace_now(CLOCK_REALTIME);
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        return -1;
+    }
+    ptedit_trace.start = ptedit_trace_now(CLOCK_MONOTONIC);
+    ptedit_trace.file = file;
+    ptedit_trace_hook();
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+void ptedit_trace_stop() {
+    pthread_mutex_lock(&ptedit_trace.lock);
+    if (ptedit_trace.file) {
+        fclose(ptedit_trace.file);
+        ptedit_trace.file = NULL;
+        if (ptedit_resolve == ptedit_resolve_traced) {
+            ptedit_resolve = ptedit_trace.resolve;
+            ptedit_update = ptedit_trace.update;
+        }
+    }
+    pthread_mutex_unlock(&ptedit_trace.lock);
+}
+
+// ---------------------------------------------------------------------------
+static void* ptedit_map_physical(size_t offset, size_t length) {
+    /* Prefer the native mapping of the device, it uses huge pages where possible */
+    void* m = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, ptedit_fd, offset);
+    if (m == MAP_FAILED && ptedit_umem > 0) {
+        m = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, ptedit_umem, offset);
+    }
+    return (m == MAP_FAILED) ? NULL : m;
+}
+
+// ---------------------------------------------------------------------------
+#define PTEDIT_PMAP_WINDOW (2ull << 20)
+#define PTEDIT_PMAP_CACHED 64
+
+typedef struct {
+    size_t base;
+    size_t size;
+    char* address;
+    size_t refs;
+    size_t last_use;
+} ptedit_pmap_window_t;
+
+static struct {
+    ptedit_pmap_window_t* windows;
+    size_t count, capacity, unused, clock, last;
+} ptedit_pmap_cache;
+static pthread_mutex_t ptedit_pmap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void ptedit_pmap_drop(size_t index) {
+    munmap(ptedit_pmap_cache.windows[index].address, ptedit_pmap_cache.windows[index].size);
+    ptedit_pmap_cache.windows[index] = ptedit_pmap_cache.windows[--ptedit_pmap_cache.count];
+    ptedit_pmap_cache.last = 0;
+}
+
+static void ptedit_pmap_evict() {
+    /* Unmap the least-recently used windows that are no longer referenced */
+    while (ptedit_pmap_cache.unused > PTEDIT_PMAP_CACHED) {
+        size_t i, victim = ptedit_pmap_cache.count;
+        for (i = 0; i < ptedit_pmap_cache.count; i++) {
+            if (ptedit_pmap_cache.windows[i].refs) continue;
+            if (victim == ptedit_pmap_cache.count || ptedit_pmap_cache.windows[i].last_use < ptedit_pmap_cache.windows[victim].last_use) victim = i;
+        }
+        ptedit_pmap_drop(victim);
+        ptedit_pmap_cache.unused--;
+    }
+}
+
+static ptedit_pmap_window_t* ptedit_pmap_find(size_t start, size_t end) {
+    size_t i;
+    ptedit_pmap_window_t* window;
+    if (ptedit_pmap_cache.last < ptedit_pmap_cache.count) {
+        window = &ptedit_pmap_cache.windows[ptedit_pmap_cache.last];
+        if (window->base <= start && end <= window->base + window->size) return window;
+    }
+    for (i = 0; i < ptedit_pmap_cache.count; i++) {
+        window = &ptedit_pmap_cache.windows[i];
+        if (window->base <= start && end <= window->base + window->size) {
+            ptedit_pmap_cache.last = i;
+            return window;
+        }
+    }
+    return NULL;
+}
+
 // ---------------------------------------------------------------------------
 void* ptedit_pmap(size_t physical, size_t length) {
-    char* m = (char *)mmap(0, length + (physical % ptedit_pagesize), PROT_READ | PROT_WRITE, MAP_SHARED, ptedit_umem, ((size_t)(physical / ptedit_pagesize)) * ptedit_pagesize);
-    return m + (physical % ptedit_pagesize);
+    size_t start = physical, end = physical + (length ? length : 1);
+    ptedit_pmap_window_t* window;
+    char* result = NULL;
+
+    pthread_mutex_lock(&ptedit_pmap_lock);
+    window = ptedit_pmap_find(start, end);
+    if (!window) {
+        ptedit_pmap_window_t fresh;
+        /* Map whole aligned windows so that nearby addresses hit the same mapping */
+        fresh.base = start & ~(PTEDIT_PMAP_WINDOW - 1);
+        fresh.size = ((end + PTEDIT_PMAP_WINDOW - 1) & ~(PTEDIT_PMAP_WINDOW - 1)) - fresh.base;
+        fresh.address = (char*)ptedit_map_physical(fresh.base, fresh.size);
+        if (!fresh.address) {
+            /* The window may reach beyond mappable memory, map only the pages of the range */
+            fresh.base = start & ~((size_t)ptedit_pagesize - 1);
+            fresh.size = ((end + ptedit_pagesize - 1) & ~((size_t)ptedit_pagesize - 1)) - fresh.base;
+            fresh.address = (char*)ptedit_map_physical(fresh.base, fresh.size);
+        }
+        if (!fresh.address) goto out;
+        fresh.refs = 0;
+        if (ptedit_pmap_cache.count == ptedit_pmap_cache.capacity) {
+            size_t capacity = ptedit_pmap_cache.capacity ? ptedit_pmap_cache.capacity * 2 : PTEDIT_PMAP_CACHED;
+            ptedit_pmap_window_t* windows = (ptedit_pmap_window_t*)realloc(ptedit_pmap_cache.windows, capacity * sizeof(ptedit_pmap_window_t));
+            if (!windows) {
+                munmap(fresh.address, fresh.size);
+                goto out;
+            }
+            ptedit_pmap_cache.windows = windows;
+            ptedit_pmap_cache.capacity = capacity;
+        }
+        ptedit_pmap_cache.last = ptedit_pmap_cache.count;
+        ptedit_pmap_cache.windows[ptedit_pmap_cache.count++] = fresh;
+        window = &ptedit_pmap_cache.windows[ptedit_pmap_cache.last];
+    } else if (!window->refs) {
+        ptedit_pmap_cache.unused--;
+    }
+    window->refs++;
+    window->last_use = ++ptedit_pmap_cache.clock;
+    result = window->address + (physical - window->base);
+out:
+    pthread_mutex_unlock(&ptedit_pmap_lock);
+    return result;
+}
+
+
+// ---------------------------------------------------------------------------
+void ptedit_punmap(void* address, size_t length) {
+    size_t i;
+    (void)length;
+    pthread_mutex_lock(&ptedit_pmap_lock);
+    for (i = 0; i < ptedit_pmap_cache.count; i++) {
+        ptedit_pmap_window_t* window = &ptedit_pmap_cache.windows[i];
+        if ((char*)address < window->address || (char*)address >= window->address + window->size) continue;
+        if (window->refs && !--window->refs) {
+            ptedit_pmap_cache.unused++;
+            ptedit_pmap_evict();
+        }
+        break;
+    }
+    pthread_mutex_unlock(&ptedit_pmap_lock);
+}
+
+
+// ---------------------------------------------------------------------------
+int ptedit_map_range(void* vaddr, size_t pfn, size_t npages, size_t flags) {
+    ptedit_map_range_t range;
+    range.vaddr = (size_t)vaddr;
+    range.pfn = pfn;
+    range.npages = npages;
+    range.flags = flags;
+    return ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_MAP_RANGE, (size_t)&range) ? -1 : 0;
+}
+
+
+// ---------------------------------------------------------------------------
+static void ptedit_pmap_free() {
+    pthread_mutex_lock(&ptedit_pmap_lock);
+    while (ptedit_pmap_cache.count) {
+        ptedit_pmap_drop(ptedit_pmap_cache.count - 1);
+    }
+    free(ptedit_pmap_cache.windows);
+    memset(&ptedit_pmap_cache, 0, sizeof(ptedit_pmap_cache));
+    pthread_mutex_unlock(&ptedit_pmap_lock);
 }
 
 // ---------------------------------------------------------------------------
@@ -326,12 +867,84 @@ void ptedit_print_entry_t(ptedit_entry_t entry) {
     }
 }
 
+
+/* The memory types only change through this library, reading them once saves a syscall and an rdmsr on every lookup */
+static struct {
+    size_t mts;
+    int cached;
+    /* Slots reprogrammed by ptedit_mt_alloc, with their previous value */
+    unsigned char owned;
+    unsigned char original[8];
+    int refs[8];
+    pthread_mutex_t lock;
+} ptedit_mt_cache = { 0, 0, 0, {0}, {0}, PTHREAD_MUTEX_INITIALIZER };
+
+#define PTEDIT_MT_SLOT(mts, slot) (((mts) >> ((slot) * 8)) & 7)
+
+
+// ---------------------------------------------------------------------------
+/* Called with ptedit_mt_cache.lock held */
+static size_t ptedit_mt_read() {
+    size_t mt = 0;
+    size_t start = ptedit_trace_begin();
+    if (ptedit_sim.active) mt = ptedit_sim.mts;
+    else if (ptedit_mt_cache.cached) mt = ptedit_mt_cache.mts;
+    else if (!ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_GET_PAT, (size_t)&mt)) {
+        ptedit_mt_cache.mts = mt;
+        ptedit_mt_cache.cached = 1;
+    }
+    if (start) ptedit_trace_end(PTEDIT_TRACE_GET_MTS, start, 0, 0, mt, NULL);
+    return mt;
+}
+
+
+// ---------------------------------------------------------------------------
+/* Called with ptedit_mt_cache.lock held, returns 0 if the memory types were changed */
+static int ptedit_mt_write(size_t mts) {
+    int result = 0;
+    size_t start = ptedit_trace_begin();
+    if (ptedit_sim.active) ptedit_sim.mts = mts;
+    else if (!ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_SET_PAT, mts)) {
+        ptedit_mt_cache.mts = mts;
+        ptedit_mt_cache.cached = 1;
+    } else {
+        result = -1;
+    }
+    if (start) ptedit_trace_end(PTEDIT_TRACE_SET_MTS, start, 0, mts, 0, NULL);
+    return result;
+}
+
+
+// ---------------------------------------------------------------------------
+static void ptedit_mt_reset() {
+    size_t mts;
+    int i;
+    pthread_mutex_lock(&ptedit_mt_cache.lock);
+    if (ptedit_mt_cache.owned) {
+        /* Give back all reprogrammed slots with a single update */
+        mts = ptedit_mt_read();
+        for (i = 0; i < 8; i++) {
+            if (!(ptedit_mt_cache.owned & (1 << i))) continue;
+            mts = (mts & ~(7ull << (i * 8))) | ((size_t)ptedit_mt_cache.original[i] << (i * 8));
+        }
+        ptedit_mt_write(mts);
+    }
+    ptedit_mt_cache.owned = 0;
+    memset(ptedit_mt_cache.refs, 0, sizeof(ptedit_mt_cache.refs));
+    ptedit_mt_cache.cached = 0;
+    pthread_mutex_unlock(&ptedit_mt_cache.lock);
+}
+
+
 // ---------------------------------------------------------------------------
 int ptedit_init() {
     if (initialized)
         return 0;
 
-    ptedit_fd = open(PTEDITOR_DEVICE_PATH, O_RDONLY);
+    ptedit_fd = open(PTEDITOR_DEVICE_PATH, O_RDWR);
+    if (ptedit_fd < 0) {
+        ptedit_fd = open(PTEDITOR_DEVICE_PATH, O_RDONLY);
+    }
     if (ptedit_fd < 0) {
         fprintf(stderr, PTEDIT_COLOR_RED "[-]" PTEDIT_COLOR_RESET "Error: Could not open PTEditor device: %s\n", PTEDITOR_DEVICE_PATH);
         return -1;
@@ -339,18 +952,7 @@ int ptedit_init() {
     ptedit_umem = open("/proc/umem", O_RDWR);
     ptedit_use_implementation(PTEDIT_IMPL_KERNEL);
     ptedit_pagesize = getpagesize();
-
-    ptedit_paging_definition.has_pgd = 1;
-    ptedit_paging_definition.has_p4d = 0;
-    ptedit_paging_definition.has_pud = 1;
-    ptedit_paging_definition.has_pmd = 1;
-    ptedit_paging_definition.has_pt = 1;
-    ptedit_paging_definition.pgd_entries = 9;
-    ptedit_paging_definition.p4d_entries = 0;
-    ptedit_paging_definition.pud_entries = 9;
-    ptedit_paging_definition.pmd_entries = 9;
-    ptedit_paging_definition.pt_entries = 9;
-    ptedit_paging_definition.page_offset = 12;
+    ptedit_init_paging_definition();
     initialized = 1;
 
     return 0;
@@ -359,6 +961,12 @@ int ptedit_init() {
 
 // ---------------------------------------------------------------------------
 void ptedit_cleanup() {
+    ptedit_trace_stop();
+    ptedit_sim_cleanup();
+    ptedit_mt_reset();
+    ptedit_async_cleanup();
+    ptedit_rmap_free();
+    ptedit_pmap_free();
     if (ptedit_fd >= 0) {
         close(ptedit_fd);
     }
@@ -371,7 +979,18 @@ void ptedit_cleanup() {
 
 // ---------------------------------------------------------------------------
 void ptedit_use_implementation(int implementation) {
-    if (implementation == PTEDIT_IMPL_KERNEL) {
+    if (implementation != PTEDIT_IMPL_SIM) ptedit_sim.active = 0;
+    if (implementation == PTEDIT_IMPL_SIM) {
+        if (!ptedit_sim.memory) {
+            fprintf(stderr, PTEDIT_COLOR_RED "[-]" PTEDIT_COLOR_RESET " Error: Simulated MMU is not initialized\n");
+            return;
+        }
+        ptedit_resolve = ptedit_resolve_sim;
+        ptedit_update = ptedit_update_sim;
+        ptedit_paging_root = ptedit_sim.root;
+        ptedit_sim.active = 1;
+    }
+    else if (implementation == PTEDIT_IMPL_KERNEL) {
         ptedit_resolve = ptedit_resolve_kernel;
         ptedit_update = ptedit_update_kernel;
     }
@@ -381,60 +1000,166 @@ void ptedit_use_implementation(int implementation) {
         ptedit_paging_root = ptedit_get_paging_root(0);
     }
     else if (implementation == PTEDIT_IMPL_USER) {
-        ptedit_resolve = ptedit_resolve_user_map;
-        ptedit_update = ptedit_update_user_map;
-        ptedit_paging_root = ptedit_get_paging_root(0);
         if (!ptedit_vmem) {
-            ptedit_vmem = (unsigned char *)mmap(NULL, 32ull * 1024ull * 1024ull * 1024ull, PROT_READ, MAP_PRIVATE | MAP_NORESERVE, ptedit_umem, 0);
+            ptedit_vmem = (unsigned char *)ptedit_map_physical(0, 32ull * 1024ull * 1024ull * 1024ull);
+            if (!ptedit_vmem) {
+                fprintf(stderr, PTEDIT_COLOR_RED "[-]" PTEDIT_COLOR_RESET " Error: Could not map physical memory\n");
+                return;
+            }
             fprintf(stderr, PTEDIT_COLOR_GREEN "[+]" PTEDIT_COLOR_RESET " Mapped physical memory to %p\n", ptedit_vmem);
         }
+        ptedit_resolve = ptedit_resolve_user_map;
+        ptedit_update = ptedit_update_user_map;
+        ptedit_paging_root = ptedit_get_paging_root(0);
     }
     else {
         fprintf(stderr, PTEDIT_COLOR_RED "[-]" PTEDIT_COLOR_RESET " Error: PTEditor implementation not supported!\n");
+        return;
     }
+    ptedit_implementation = implementation;
+    ptedit_trace_hook();
 }
 
 
 // ---------------------------------------------------------------------------
 int ptedit_get_pagesize() {
+    if (ptedit_sim.active) return ptedit_pagesize;
     return (int)ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_GET_PAGESIZE, 0);
 }
 
 
 // ---------------------------------------------------------------------------
 void ptedit_read_physical_page(size_t pfn, char* buffer) {
-    if (ptedit_umem > 0) {
+    size_t start = ptedit_trace_begin();
+    if (ptedit_sim.active) {
+        ptedit_sim_transfer(pfn * ptedit_pagesize, buffer, ptedit_pagesize, 0);
+    }
+    else if (ptedit_umem > 0) {
         pread(ptedit_umem, buffer, ptedit_pagesize, pfn * ptedit_pagesize);
     }
     else {
         ptedit_page_t page;
         page.buffer = (unsigned char*)buffer;
         page.pfn = pfn;
+        page.vaddr = 0;
+        page.size = ptedit_pagesize;
         ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_READ_PAGE, (size_t)&page);
     }
+    if (start) ptedit_trace_end(PTEDIT_TRACE_READ_PAGE, start, 0, pfn, 0, NULL);
 }
 
 
 // ---------------------------------------------------------------------------
 void ptedit_write_physical_page(size_t pfn, char* content) {
-    if (ptedit_umem > 0) {
+    size_t start = ptedit_trace_begin();
+    if (ptedit_sim.active) {
+        ptedit_sim_transfer(pfn * ptedit_pagesize, content, ptedit_pagesize, 1);
+    }
+    else if (ptedit_umem > 0) {
         pwrite(ptedit_umem, content, ptedit_pagesize, pfn * ptedit_pagesize);
     }
     else {
         ptedit_page_t page;
         page.buffer = (unsigned char*)content;
         page.pfn = pfn;
+        page.vaddr = 0;
+        page.size = ptedit_pagesize;
         ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_WRITE_PAGE, (size_t)&page);
     }
+    if (start) ptedit_trace_end(PTEDIT_TRACE_WRITE_PAGE, start, 0, pfn, 0, NULL);
+}
+
+
+// ---------------------------------------------------------------------------
+static void ptedit_transfer_physical_range(size_t pfn, char* buffer, size_t length, int write) {
+    /* The kernel copies contiguous runs in large chunks, which is faster than /proc/umem */
+    ptedit_page_t page;
+    if (ptedit_sim.active) {
+        ptedit_sim_transfer(pfn * ptedit_pagesize, buffer, length, write);
+        return;
+    }
+    page.pfn = pfn;
+    page.vaddr = 0;
+    page.size = length;
+    page.buffer = (unsigned char*)buffer;
+    ioctl(ptedit_fd, write ? PTEDITOR_IOCTL_CMD_WRITE_PAGE : PTEDITOR_IOCTL_CMD_READ_PAGE, (size_t)&page);
+}
+
+
+// ---------------------------------------------------------------------------
+void ptedit_read_physical_range(size_t pfn, char* buffer, size_t length) {
+    ptedit_transfer_physical_range(pfn, buffer, length, 0);
+}
+
+
+// ---------------------------------------------------------------------------
+void ptedit_write_physical_range(size_t pfn, char* content, size_t length) {
+    ptedit_transfer_physical_range(pfn, content, length, 1);
+}
+
+
+// ---------------------------------------------------------------------------
+static void ptedit_transfer_physical_pages(const size_t* pfns, char** buffers, size_t count, int write) {
+    struct iovec iov[PTEDIT_IOV_MAX];
+    ptedit_pages_t pages;
+    size_t i, j, k, n;
+    if (ptedit_sim.active) {
+        for (i = 0; i < count; i++) {
+            ptedit_sim_transfer(pfns[i] * ptedit_pagesize, buffers[i], ptedit_pagesize, write);
+        }
+        return;
+    }
+    pages.count = 0;
+    pages.pages = (ptedit_page_t*)malloc(count * sizeof(ptedit_page_t));
+    if (!pages.pages) return;
+    for (i = 0; i < count; i = j) {
+        for (j = i + 1; j < count && pfns[j] == pfns[i] + (j - i); j++);
+        /* Long runs of consecutive frames are vectored transfers, all other frames are gathered into a single ioctl */
+        if (ptedit_umem > 0 && j - i >= PTEDIT_UMEM_MIN_RUN) {
+            for (k = i; k < j; k += n) {
+                for (n = 0; n < j - k && n < PTEDIT_IOV_MAX; n++) {
+                    iov[n].iov_base = buffers[k + n];
+                    iov[n].iov_len = ptedit_pagesize;
+                }
+                if (write) pwritev(ptedit_umem, iov, (int)n, pfns[k] * ptedit_pagesize);
+                else preadv(ptedit_umem, iov, (int)n, pfns[k] * ptedit_pagesize);
+            }
+            continue;
+        }
+        for (k = i; k < j; k++, pages.count++) {
+            pages.pages[pages.count].pfn = pfns[k];
+            pages.pages[pages.count].vaddr = 0;
+            pages.pages[pages.count].size = ptedit_pagesize;
+            pages.pages[pages.count].buffer = (unsigned char*)buffers[k];
+        }
+    }
+    if (pages.count) ioctl(ptedit_fd, write ? PTEDITOR_IOCTL_CMD_WRITE_PAGES : PTEDITOR_IOCTL_CMD_READ_PAGES, (size_t)&pages);
+    free(pages.pages);
+}
+
+
+// ---------------------------------------------------------------------------
+void ptedit_read_physical_pages(const size_t* pfns, char** buffers, size_t count) {
+    ptedit_transfer_physical_pages(pfns, buffers, count, 0);
+}
+
+
+// ---------------------------------------------------------------------------
+void ptedit_write_physical_pages(const size_t* pfns, char** contents, size_t count) {
+    ptedit_transfer_physical_pages(pfns, contents, count, 1);
 }
 
 
 // ---------------------------------------------------------------------------
 size_t ptedit_get_paging_root(pid_t pid) {
     ptedit_paging_t cr3;
+    size_t start = ptedit_trace_begin();
     cr3.pid = (size_t)pid;
     cr3.root = 0;
-    ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_GET_ROOT, (size_t)&cr3);
+    /* The simulation has a single address space */
+    if (ptedit_sim.active) cr3.root = ptedit_sim.root;
+    else ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_GET_ROOT, (size_t)&cr3);
+    if (start) ptedit_trace_end(PTEDIT_TRACE_GET_ROOT, start, pid, 0, cr3.root, NULL);
     return cr3.root;
 }
 
@@ -442,22 +1167,83 @@ size_t ptedit_get_paging_root(pid_t pid) {
 // ---------------------------------------------------------------------------
 void ptedit_set_paging_root(pid_t pid, size_t root) {
     ptedit_paging_t cr3;
+    size_t start = ptedit_trace_begin();
     cr3.pid = (size_t)pid;
     cr3.root = root; 
-    ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_SET_ROOT, (size_t)&cr3);
+    if (ptedit_sim.active) ptedit_sim.root = ptedit_paging_root = root;
+    else ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_SET_ROOT, (size_t)&cr3);
+    if (start) ptedit_trace_end(PTEDIT_TRACE_SET_ROOT, start, pid, root, 0, NULL);
+}
+
+
+// ---------------------------------------------------------------------------
+static size_t ptedit_sim_clone_table(size_t table, int level, size_t base, size_t start, size_t end, size_t shared_levels) {
+    const size_t masks[4] = { PTEDIT_VALID_MASK_PTE, PTEDIT_VALID_MASK_PMD, PTEDIT_VALID_MASK_PUD, PTEDIT_VALID_MASK_PGD };
+    size_t copy = ptedit_sim_alloc_frame() * ptedit_pagesize, size = 1ull << (12 + 9 * level), i, entry, child;
+
+    if (!copy) return 0;
+    memcpy(ptedit_sim.memory + copy, ptedit_sim.memory + table, ptedit_pagesize);
+    if (!level || (shared_levels & masks[level - 1])) return copy;
+    for (i = 0; i < 512; i++) {
+        if (base + (i + 1) * size <= start || base + i * size >= end) continue;
+        entry = ptedit_phys_read_sim(table + i * sizeof(size_t));
+        if (!ptedit_sim_present(entry) || (entry & (1ull << PTEDIT_PAGE_BIT_PSE))) continue;
+        /* Synthetic entries outside of the simulated memory stay as they are */
+        if (ptedit_get_pfn(entry) * ptedit_pagesize > ptedit_sim.size - ptedit_pagesize) continue;
+        child = ptedit_sim_clone_table(ptedit_get_pfn(entry) * ptedit_pagesize, level - 1, base + i * size, start, end, shared_levels);
+        if (!child) return 0;
+        ptedit_phys_write_sim(copy + i * sizeof(size_t), ptedit_set_pfn(entry, child / ptedit_pagesize));
+    }
+    return copy;
+}
+
+// ---------------------------------------------------------------------------
+size_t ptedit_clone_paging_root(pid_t pid, void* address, size_t length, size_t shared_levels) {
+    ptedit_clone_t clone;
+    if (ptedit_sim.active) {
+        size_t start = (size_t)address & ~((size_t)ptedit_pagesize - 1);
+        return ptedit_sim_clone_table(ptedit_sim.root, 3, 0, start, length ? (size_t)address + length : (1ull << 47), shared_levels);
+    }
+    clone.pid = (size_t)pid;
+    clone.vaddr = (size_t)address;
+    clone.length = length;
+    clone.share = shared_levels;
+    clone.root = 0;
+    if (ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_CLONE_ROOT, (size_t)&clone)) return 0;
+    return clone.root;
+}
+
+// ---------------------------------------------------------------------------
+int ptedit_destroy_paging_root(size_t root) {
+    /* Frames of the simulation are never freed */
+    if (ptedit_sim.active) return 0;
+    return ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_DESTROY_ROOT, root) ? -1 : 0;
 }
 
 
 // ---------------------------------------------------------------------------
 void ptedit_invalidate_tlb(void* address) {
-    ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_INVALIDATE_TLB, (size_t)address);
+    size_t start = ptedit_trace_begin();
+    if (!ptedit_sim.active) ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_INVALIDATE_TLB, (size_t)address);
+    if (start) ptedit_trace_end(PTEDIT_TRACE_INVALIDATE_TLB, start, 0, (size_t)address, 0, NULL);
+}
+
+
+// ---------------------------------------------------------------------------
+int ptedit_set_tlb_strategy(int strategy, size_t cpus) {
+    ptedit_tlb_strategy_t request;
+    request.strategy = strategy;
+    request.cpus = cpus;
+    return ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_SET_TLB_STRATEGY, (size_t)&request) ? -1 : 0;
 }
 
 
 // ---------------------------------------------------------------------------
 size_t ptedit_get_mts() {
-    size_t mt = 0;
-    ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_GET_PAT, (size_t)&mt);
+    size_t mt;
+    pthread_mutex_lock(&ptedit_mt_cache.lock);
+    mt = ptedit_mt_read();
+    pthread_mutex_unlock(&ptedit_mt_cache.lock);
     return mt;
 }
 
@@ -479,33 +1265,103 @@ const char* ptedit_mt_to_string(unsigned char mt) {
 
 // ---------------------------------------------------------------------------
 void ptedit_set_mts(size_t mts) {
-    ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_SET_PAT, mts);
+    pthread_mutex_lock(&ptedit_mt_cache.lock);
+    ptedit_mt_write(mts);
+    pthread_mutex_unlock(&ptedit_mt_cache.lock);
 }
 
 
 // ---------------------------------------------------------------------------
 void ptedit_set_mt(unsigned char mt, unsigned char value) {
-    size_t mts = ptedit_get_mts();
-    mts &= ~(7 << (mt * 8));
+    size_t mts;
+    pthread_mutex_lock(&ptedit_mt_cache.lock);
+    mts = ptedit_mt_read();
+    mts &= ~(7ull << (mt * 8));
     mts |= ((size_t)value << (mt * 8));
-    ptedit_set_mts(mts);
+    ptedit_mt_write(mts);
+    pthread_mutex_unlock(&ptedit_mt_cache.lock);
 }
 
 
 // ---------------------------------------------------------------------------
-unsigned char ptedit_find_mt(unsigned char type) {
-    size_t mts = ptedit_get_mts();
-    unsigned char found = 0;
-    int i;
-    for (i = 0; i < 8; i++) {
-        if (((mts >> (i * 8)) & 7) == type) found |= (1 << i);
-    }
-    return found;
+size_t ptedit_mt_refresh() {
+    size_t mts;
+    pthread_mutex_lock(&ptedit_mt_cache.lock);
+    ptedit_mt_cache.cached = 0;
+    mts = ptedit_mt_read();
+    pthread_mutex_unlock(&ptedit_mt_cache.lock);
+    return mts;
 }
 
 
 // ---------------------------------------------------------------------------
-int ptedit_find_first_mt(unsigned char type) {
+int ptedit_mt_alloc(unsigned char type) {
+    size_t mts;
+    int slot = -1, i, j;
+
+    pthread_mutex_lock(&ptedit_mt_cache.lock);
+    mts = ptedit_mt_read();
+    for (i = 0; i < 8 && slot < 0; i++) {
+        if (PTEDIT_MT_SLOT(mts, i) == type) slot = i;
+    }
+    /* Only reprogram upper slots which are unused or duplicate a lower slot, the kernel always uses the lowest slot of a type */
+    for (i = 7; i >= 4 && slot < 0; i--) {
+        if (ptedit_mt_cache.refs[i]) continue;
+        if (ptedit_mt_cache.owned & (1 << i)) slot = i;
+        for (j = 0; j < i && slot < 0; j++) {
+            if (PTEDIT_MT_SLOT(mts, j) == PTEDIT_MT_SLOT(mts, i)) slot = i;
+        }
+        if (slot < 0) continue;
+        /* Without write access to the PAT, the slot still has its old type */
+        if (ptedit_mt_write((mts & ~(7ull << (slot * 8))) | ((size_t)type << (slot * 8)))) {
+            slot = -1;
+            break;
+        }
+        if (!(ptedit_mt_cache.owned & (1 << slot))) {
+            ptedit_mt_cache.original[slot] = PTEDIT_MT_SLOT(mts, slot);
+            ptedit_mt_cache.owned |= (1 << slot);
+        }
+    }
+    if (slot >= 0) ptedit_mt_cache.refs[slot]++;
+    pthread_mutex_unlock(&ptedit_mt_cache.lock);
+    return slot;
+}
+
+
+// ---------------------------------------------------------------------------
+int ptedit_mt_release(int mt) {
+    size_t mts;
+    if (mt < 0 || mt > 7) return -1;
+    pthread_mutex_lock(&ptedit_mt_cache.lock);
+    if (!ptedit_mt_cache.refs[mt]) {
+        pthread_mutex_unlock(&ptedit_mt_cache.lock);
+        return -1;
+    }
+    if (!--ptedit_mt_cache.refs[mt] && (ptedit_mt_cache.owned & (1 << mt))) {
+        mts = ptedit_mt_read() & ~(7ull << (mt * 8));
+        ptedit_mt_write(mts | ((size_t)ptedit_mt_cache.original[mt] << (mt * 8)));
+        ptedit_mt_cache.owned &= ~(1 << mt);
+    }
+    pthread_mutex_unlock(&ptedit_mt_cache.lock);
+    return 0;
+}
+
+
+
+// ---------------------------------------------------------------------------
+unsigned char ptedit_find_mt(unsigned char type) {
+    size_t mts = ptedit_get_mts();
+    unsigned char found = 0;
+    int i;
+    for (i = 0; i < 8; i++) {
+        if (((mts >> (i * 8)) & 7) == type) found |= (1 << i);
+    }
+    return found;
+}
+
+
+// ---------------------------------------------------------------------------
+int ptedit_find_first_mt(unsigned char type) {
     return __builtin_ffs(ptedit_find_mt(type)) - 1;
 }
 
@@ -524,6 +1380,29 @@ unsigned char ptedit_extract_mt(size_t entry) {
     return (!!(entry & (1ull << PTEDIT_PAGE_BIT_PWT))) | ((!!(entry & (1ull << PTEDIT_PAGE_BIT_PCD))) << 1) | ((!!(entry & (1ull << PTEDIT_PAGE_BIT_PAT))) << 2);
 }
 
+// ---------------------------------------------------------------------------
+int ptedit_set_mt_range(void* address, size_t length, pid_t pid, unsigned char mt) {
+    ptedit_mt_range_t range;
+    size_t offset;
+    if (mt > 7) return -1;
+    if (ptedit_sim.active) {
+        /* The simulation has neither a TLB nor caches, page by page is all there is to do */
+        for (offset = 0; offset < length; offset += ptedit_pagesize) {
+            ptedit_entry_t vm = ptedit_resolve((char*)address + offset, pid);
+            if (!(vm.valid & PTEDIT_VALID_MASK_PTE)) continue;
+            vm.pte = ptedit_apply_mt(vm.pte, mt);
+            vm.valid = PTEDIT_VALID_MASK_PTE;
+            ptedit_update((char*)address + offset, pid, &vm);
+        }
+        return 0;
+    }
+    range.pid = pid;
+    range.vaddr = (size_t)address;
+    range.length = length;
+    range.mt = mt;
+    return ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_SET_MT_RANGE, (size_t)&range) ? -1 : 0;
+}
+
 // ---------------------------------------------------------------------------
 void ptedit_full_serializing_barrier() {
     asm volatile("mfence\nlfence\n" ::: "memory");
@@ -532,22 +1411,112 @@ void ptedit_full_serializing_barrier() {
 }
 
 
+// ---------------------------------------------------------------------------
+static int ptedit_atomic(void* address, pid_t pid, size_t op, ptedit_entry_t* expected, ptedit_entry_t* desired) {
+    ptedit_atomic_t request;
+    ptedit_entry_t vm, previous, compare;
+    size_t start, levels;
+    int i;
+
+    if (ptedit_implementation == PTEDIT_IMPL_KERNEL && !ptedit_sim.active) {
+        start = ptedit_trace_begin();
+        memset(&request, 0, sizeof(request));
+        request.op = op;
+        if (expected) request.expected = *expected;
+        request.desired = *desired;
+        request.desired.pid = pid;
+        request.desired.vaddr = (size_t)address;
+        if (ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_VM_ATOMIC, (size_t)&request)) request.actual.valid = (size_t)-1;
+        if (start) ptedit_trace_end(PTEDIT_TRACE_ATOMIC, start, pid, (size_t)address, request.actual.valid, desired);
+        if (request.actual.valid == (size_t)-1) return -1;
+        if (expected) *expected = request.actual;
+        return (int)request.actual.valid;
+    }
+
+    /* The other implementations cannot update entries atomically */
+    if (op == PTEDIT_ATOMIC_CMPXCHG && !expected) return -1;
+    previous = vm = ptedit_resolve(address, pid);
+    compare = expected ? *expected : vm;
+    levels = vm.valid & desired->valid;
+    {
+        size_t* current[5] = { &vm.pgd, &vm.p4d, &vm.pud, &vm.pmd, &vm.pte };
+        const size_t value[5] = { desired->pgd, desired->p4d, desired->pud, desired->pmd, desired->pte };
+        const size_t old[5] = { compare.pgd, compare.p4d, compare.pud, compare.pmd, compare.pte };
+        for (i = 0; i < 5; i++) {
+            if (!(levels & (1 << i))) continue;
+            if (op == PTEDIT_ATOMIC_OR) *current[i] |= value[i];
+            else if (op == PTEDIT_ATOMIC_ANDNOT) *current[i] &= ~value[i];
+            else if (*current[i] == old[i]) *current[i] = value[i];
+            else levels &= ~(1 << i);
+        }
+    }
+    vm.valid = levels;
+    if (levels) ptedit_update(address, pid, &vm);
+    if (expected) {
+        *expected = previous;
+        expected->valid = levels;
+    }
+    return (int)levels;
+}
+
+
+// ---------------------------------------------------------------------------
+int ptedit_cmpxchg(void* address, pid_t pid, ptedit_entry_t* expected, ptedit_entry_t* desired) {
+    return ptedit_atomic(address, pid, PTEDIT_ATOMIC_CMPXCHG, expected, desired);
+}
+
+
+// ---------------------------------------------------------------------------
+size_t ptedit_pte_fetch_or(void* address, pid_t pid, size_t bits) {
+    ptedit_entry_t desired, previous;
+    memset(&previous, 0, sizeof(previous));
+    desired.pte = bits;
+    desired.valid = PTEDIT_VALID_MASK_PTE;
+    if (ptedit_atomic(address, pid, PTEDIT_ATOMIC_OR, &previous, &desired) <= 0) return 0;
+    return previous.pte;
+}
+
+
+// ---------------------------------------------------------------------------
+size_t ptedit_pte_fetch_andnot(void* address, pid_t pid, size_t bits) {
+    ptedit_entry_t desired, previous;
+    memset(&previous, 0, sizeof(previous));
+    desired.pte = bits;
+    desired.valid = PTEDIT_VALID_MASK_PTE;
+    if (ptedit_atomic(address, pid, PTEDIT_ATOMIC_ANDNOT, &previous, &desired) <= 0) return 0;
+    return previous.pte;
+}
+
 // ---------------------------------------------------------------------------
 void ptedit_pte_set_bit(void* address, pid_t pid, int bit) {
-    ptedit_entry_t vm = ptedit_resolve(address, pid);
-    if (!(vm.valid & PTEDIT_VALID_MASK_PTE)) return;
-    vm.pte |= (1ull << bit);
-    vm.valid = PTEDIT_VALID_MASK_PTE;
-    ptedit_update(address, pid, &vm);
+    ptedit_pte_fetch_or(address, pid, 1ull << bit);
 }
 
 // ---------------------------------------------------------------------------
 void ptedit_pte_clear_bit(void* address, pid_t pid, int bit) {
-    ptedit_entry_t vm = ptedit_resolve(address, pid);
-    if (!(vm.valid & PTEDIT_VALID_MASK_PTE)) return;
-    vm.pte &= ~(1ull << bit);
-    vm.valid = PTEDIT_VALID_MASK_PTE;
-    ptedit_update(address, pid, &vm);
+    ptedit_pte_fetch_andnot(address, pid, 1ull << bit);
+}
+
+// ---------------------------------------------------------------------------
+int ptedit_range_modify_bits(void* address, size_t length, pid_t pid, size_t set_mask, size_t clear_mask) {
+    ptedit_bits_range_t range;
+    size_t offset;
+    if (ptedit_sim.active) {
+        for (offset = 0; offset < length; offset += ptedit_pagesize) {
+            ptedit_entry_t vm = ptedit_resolve((char*)address + offset, pid);
+            if (!(vm.valid & PTEDIT_VALID_MASK_PTE)) continue;
+            vm.pte = (vm.pte & ~clear_mask) | set_mask;
+            vm.valid = PTEDIT_VALID_MASK_PTE;
+            ptedit_update((char*)address + offset, pid, &vm);
+        }
+        return 0;
+    }
+    range.pid = pid;
+    range.vaddr = (size_t)address;
+    range.length = length;
+    range.set = set_mask;
+    range.clear = clear_mask;
+    return ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_MODIFY_BITS_RANGE, (size_t)&range) ? -1 : 0;
 }
 
 // ---------------------------------------------------------------------------
@@ -572,6 +1541,45 @@ void ptedit_pte_set_pfn(void* address, pid_t pid, size_t pfn) {
     ptedit_update(address, pid, &vm);
 }
 
+// ---------------------------------------------------------------------------
+static int ptedit_sim_share(pid_t src_pid, char* src, pid_t dst_pid, char* dst, size_t length) {
+    size_t offset;
+    /* The simulation has no reference counts, the entries are simply copied */
+    for (offset = 0; offset < length; offset += ptedit_pagesize) {
+        ptedit_entry_t from = ptedit_resolve(src + offset, src_pid);
+        ptedit_entry_t to = ptedit_resolve(dst + offset, dst_pid);
+        if (!(from.valid & PTEDIT_VALID_MASK_PTE) || !(from.pte & PTEDIT_PAGE_PRESENT)) return -1;
+        if (!(to.valid & PTEDIT_VALID_MASK_PTE) || to.pte) return -1;
+        to.pte = from.pte;
+        to.valid = PTEDIT_VALID_MASK_PTE;
+        ptedit_update(dst + offset, dst_pid, &to);
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+int ptedit_alias_range(void* dst, void* src, size_t length, pid_t pid) {
+    ptedit_alias_range_t range;
+    if (ptedit_sim.active) return ptedit_sim_share(pid, (char*)src, pid, (char*)dst, length);
+    range.pid = pid;
+    range.dst = (size_t)dst;
+    range.src = (size_t)src;
+    range.length = length;
+    return ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_ALIAS_RANGE, (size_t)&range) ? -1 : 0;
+}
+
+// ---------------------------------------------------------------------------
+int ptedit_share_range(pid_t src_pid, void* src_addr, pid_t dst_pid, void* dst_addr, size_t length) {
+    ptedit_share_range_t range;
+    if (ptedit_sim.active) return ptedit_sim_share(src_pid, (char*)src_addr, dst_pid, (char*)dst_addr, length);
+    range.src_pid = src_pid;
+    range.src = (size_t)src_addr;
+    range.dst_pid = dst_pid;
+    range.dst = (size_t)dst_addr;
+    range.length = length;
+    return ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_SHARE_RANGE, (size_t)&range) ? -1 : 0;
+}
+
 void ptedit_tlb_shootdown(size_t cpu_mask) {
     ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_TLB_SHOOTDOWN, cpu_mask);
 }
@@ -580,3 +1588,969 @@ void ptedit_map_page(void* address, size_t pfn) {
     ptedit_page_t page_object = {pfn, (size_t)address, 0, NULL};
     ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_MAP_PAGE, &page_object);
 }
+
+
+// ---------------------------------------------------------------------------
+#define PTEDIT_SEARCH_CHUNK (64ull << 20)
+#define PTEDIT_SEARCH_MAX_NODES 64
+#define PTEDIT_SEARCH_MAX_CPUS 4096
+
+typedef struct {
+    size_t start, end, limit;
+    int node;
+} ptedit_search_chunk_t;
+
+typedef struct {
+    ptedit_search_chunk_t* chunks;
+    size_t count, next;
+} ptedit_search_queue_t;
+
+typedef struct {
+    const char* pattern;
+    size_t length;
+    ptedit_phys_search_callback_t callback;
+    ptedit_search_queue_t queues[PTEDIT_SEARCH_MAX_NODES];
+    unsigned long cpus[PTEDIT_SEARCH_MAX_NODES][PTEDIT_SEARCH_MAX_CPUS / (8 * sizeof(unsigned long))];
+    int nodes;
+    size_t matches;
+    int stop;
+    pthread_mutex_t lock;
+} ptedit_search_t;
+
+typedef struct {
+    ptedit_search_t* search;
+    int node;
+} ptedit_search_worker_t;
+
+
+// ---------------------------------------------------------------------------
+static const char* ptedit_search_memory(const char* haystack, size_t size, const char* pattern, size_t length) {
+    size_t i = 0;
+    if (length > size) return NULL;
+    if (length == 1) return (const char*)memchr(haystack, pattern[0], size);
+#if defined(__SSE2__)
+    /* Filter on the first two bytes, 16 positions at a time */
+    __m128i first = _mm_set1_epi8(pattern[0]), second = _mm_set1_epi8(pattern[1]);
+    for (; i + 17 <= size; i += 16) {
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(haystack + i));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(haystack + i + 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(b0, first), _mm_cmpeq_epi8(b1, second)));
+        while (mask) {
+            size_t offset = i + __builtin_ctz(mask);
+            if (offset + length <= size && !memcmp(haystack + offset + 2, pattern + 2, length - 2)) return haystack + offset;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    while (i + length <= size) {
+        const char* candidate = (const char*)memchr(haystack + i, pattern[0], size - length + 1 - i);
+        if (!candidate) return NULL;
+        if (!memcmp(candidate + 1, pattern + 1, length - 1)) return candidate;
+        i = (size_t)(candidate - haystack) + 1;
+    }
+    return NULL;
+}
+
+
+// ---------------------------------------------------------------------------
+static size_t ptedit_read_sysfs_hex(const char* path) {
+    size_t value = 0;
+    FILE* f = fopen(path, "r");
+    if (!f) return 0;
+    if (fscanf(f, "%zx", &value) != 1) value = 0;
+    fclose(f);
+    return value;
+}
+
+
+// ---------------------------------------------------------------------------
+static void ptedit_search_parse_cpulist(const char* path, unsigned long* mask) {
+    char line[4096];
+    char* p = line;
+    FILE* f = fopen(path, "r");
+    if (!f) return;
+    if (!fgets(line, sizeof(line), f)) line[0] = 0;
+    fclose(f);
+    while (*p >= '0' && *p <= '9') {
+        long from = strtol(p, &p, 10), to = from, cpu;
+        if (*p == '-') to = strtol(p + 1, &p, 10);
+        for (cpu = from; cpu <= to && cpu < PTEDIT_SEARCH_MAX_CPUS; cpu++) {
+            mask[cpu / (8 * sizeof(unsigned long))] |= 1ul << (cpu % (8 * sizeof(unsigned long)));
+        }
+        if (*p == ',') p++;
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+static int ptedit_search_node_of(const unsigned char* block_nodes, size_t blocks, size_t block_size, size_t address) {
+    if (!block_size || address / block_size >= blocks) return 0;
+    return block_nodes[address / block_size];
+}
+
+
+// ---------------------------------------------------------------------------
+static void* ptedit_search_worker(void* arg) {
+    ptedit_search_worker_t* worker = (ptedit_search_worker_t*)arg;
+    ptedit_search_t* search = worker->search;
+    int n;
+
+    syscall(SYS_sched_setaffinity, 0, sizeof(search->cpus[worker->node]), search->cpus[worker->node]);
+
+    /* Work on the local node first, then help the others */
+    for (n = 0; n < search->nodes && !__atomic_load_n(&search->stop, __ATOMIC_RELAXED); n++) {
+        ptedit_search_queue_t* queue = &search->queues[(worker->node + n) % search->nodes];
+        size_t index;
+        while ((index = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->count) {
+            ptedit_search_chunk_t* chunk = &queue->chunks[index];
+            size_t size = chunk->limit - chunk->start, offset = 0;
+            const char* window = (const char*)ptedit_map_physical(chunk->start, size);
+            const char* match;
+            if (!window) continue;
+            while ((match = ptedit_search_memory(window + offset, size - offset, search->pattern, search->length))) {
+                offset = (size_t)(match - window);
+                /* Matches in the overlap belong to the next chunk */
+                if (chunk->start + offset >= chunk->end) break;
+                pthread_mutex_lock(&search->lock);
+                if (!search->stop) {
+                    search->matches++;
+                    if (search->callback && search->callback(chunk->start + offset)) search->stop = 1;
+                }
+                pthread_mutex_unlock(&search->lock);
+                if (__atomic_load_n(&search->stop, __ATOMIC_RELAXED)) break;
+                offset++;
+            }
+            munmap((void*)window, size);
+            if (__atomic_load_n(&search->stop, __ATOMIC_RELAXED)) break;
+        }
+    }
+    return NULL;
+}
+
+
+// ---------------------------------------------------------------------------
+ssize_t ptedit_phys_search(const void* pattern, size_t length, ptedit_phys_search_callback_t callback, int nthreads) {
+    ptedit_search_t* search;
+    ptedit_search_worker_t* workers;
+    pthread_t* threads;
+    unsigned char* block_nodes = NULL;
+    size_t blocks = 0, block_size, i;
+    char line[256], path[512];
+    int node, nodes_used[PTEDIT_SEARCH_MAX_NODES] = { 0 }, used = 0;
+    ssize_t result = -1;
+    FILE* iomem;
+    DIR* dir;
+    struct dirent* de;
+
+    if (!pattern || !length) return -1;
+    search = (ptedit_search_t*)calloc(1, sizeof(ptedit_search_t));
+    if (!search) return -1;
+    search->pattern = (const char*)pattern;
+    search->length = length;
+    search->callback = callback;
+    pthread_mutex_init(&search->lock, NULL);
+
+    /* Assign memory blocks to NUMA nodes */
+    block_size = ptedit_read_sysfs_hex("/sys/devices/system/memory/block_size_bytes");
+    for (node = 0; node < PTEDIT_SEARCH_MAX_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", node);
+        if (!(dir = opendir(path))) continue;
+        search->nodes = node + 1;
+        while ((de = readdir(dir))) {
+            size_t block;
+            if (sscanf(de->d_name, "memory%zu", &block) != 1) continue;
+            if (block >= blocks) {
+                unsigned char* grown = (unsigned char*)realloc(block_nodes, block + 1);
+                if (!grown) continue;
+                memset(grown + blocks, 0, block + 1 - blocks);
+                block_nodes = grown;
+                blocks = block + 1;
+            }
+            block_nodes[block] = (unsigned char)node;
+        }
+        closedir(dir);
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        ptedit_search_parse_cpulist(path, search->cpus[node]);
+    }
+    if (!search->nodes) {
+        search->nodes = 1;
+        memset(search->cpus[0], 0xff, sizeof(search->cpus[0]));
+    }
+
+    /* Only scan System RAM, split into chunks that do not cross node boundaries */
+    iomem = fopen("/proc/iomem", "r");
+    if (!iomem) goto out;
+    while (fgets(line, sizeof(line), iomem)) {
+        size_t start, end, chunk;
+        if (line[0] == ' ' || !strstr(line, ": System RAM")) continue;
+        if (sscanf(line, "%zx-%zx", &start, &end) != 2) continue;
+        if (!end) continue;
+        end++;
+        for (chunk = start; chunk < end; ) {
+            size_t chunk_end = (chunk & ~(PTEDIT_SEARCH_CHUNK - 1)) + PTEDIT_SEARCH_CHUNK;
+            ptedit_search_queue_t* queue;
+            ptedit_search_chunk_t* grown;
+            if (chunk_end > end) chunk_end = end;
+            node = ptedit_search_node_of(block_nodes, blocks, block_size, chunk);
+            queue = &search->queues[node];
+            grown = (ptedit_search_chunk_t*)realloc(queue->chunks, (queue->count + 1) * sizeof(ptedit_search_chunk_t));
+            if (!grown) break;
+            queue->chunks = grown;
+            queue->chunks[queue->count].start = chunk;
+            queue->chunks[queue->count].end = chunk_end;
+            queue->chunks[queue->count].limit = (chunk_end + length - 1 < end) ? chunk_end + length - 1 : end;
+            queue->chunks[queue->count].node = node;
+            queue->count++;
+            chunk = chunk_end;
+        }
+    }
+    fclose(iomem);
+    for (node = 0; node < search->nodes; node++) {
+        if (search->queues[node].count) nodes_used[used++] = node;
+    }
+    if (!used) {
+        /* /proc/iomem shows only zero addresses to unprivileged users */
+        fprintf(stderr, PTEDIT_COLOR_RED "[-]" PTEDIT_COLOR_RESET " Error: Could not read System RAM ranges from /proc/iomem\n");
+        goto out;
+    }
+
+    if (nthreads <= 0) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0) nthreads = 1;
+    threads = (pthread_t*)calloc((size_t)nthreads, sizeof(pthread_t));
+    workers = (ptedit_search_worker_t*)calloc((size_t)nthreads, sizeof(ptedit_search_worker_t));
+    if (threads && workers) {
+        int started = 0;
+        for (i = 0; i < (size_t)nthreads; i++) {
+            workers[i].search = search;
+            workers[i].node = nodes_used[i % used];
+            if (!pthread_create(&threads[i], NULL, ptedit_search_worker, &workers[i])) started++;
+            else threads[i] = 0;
+        }
+        for (i = 0; i < (size_t)nthreads; i++) {
+            if (threads[i]) pthread_join(threads[i], NULL);
+        }
+        if (started) result = (ssize_t)search->matches;
+    }
+    free(threads);
+    free(workers);
+
+out:
+    for (node = 0; node < PTEDIT_SEARCH_MAX_NODES; node++) free(search->queues[node].chunks);
+    pthread_mutex_destroy(&search->lock);
+    free(search);
+    free(block_nodes);
+    return result;
+}
+
+
+// ---------------------------------------------------------------------------
+typedef struct {
+    size_t pfn, pid, vaddr;
+} ptedit_rmap_tuple_t;
+
+typedef struct {
+    ptedit_rmap_tuple_t* data;
+    size_t count, capacity;
+} ptedit_rmap_list_t;
+
+typedef struct {
+    const pid_t* pids;
+    size_t count, next;
+} ptedit_rmap_job_t;
+
+typedef struct {
+    ptedit_rmap_job_t* job;
+    ptedit_rmap_list_t list;
+    int failed;
+} ptedit_rmap_worker_t;
+
+static struct {
+    /* Mappings sorted by pfn, the run-length index gives the first mapping and count of every pfn */
+    ptedit_rmap_entry_t* entries;
+    size_t count;
+    size_t* run_pfn;
+    size_t* run_start;
+    size_t runs;
+} ptedit_rmap;
+
+static pthread_mutex_t ptedit_rmap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// ---------------------------------------------------------------------------
+static int ptedit_rmap_add(ptedit_rmap_list_t* list, size_t pfn, size_t pid, size_t vaddr) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 4096;
+        ptedit_rmap_tuple_t* grown = (ptedit_rmap_tuple_t*)realloc(list->data, capacity * sizeof(ptedit_rmap_tuple_t));
+        if (!grown) return -1;
+        list->data = grown;
+        list->capacity = capacity;
+    }
+    list->data[list->count].pfn = pfn;
+    list->data[list->count].pid = pid;
+    list->data[list->count].vaddr = vaddr;
+    list->count++;
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+static int ptedit_rmap_walk(ptedit_rmap_list_t* list, size_t pid, size_t table, int level, size_t vaddr, size_t** buffers) {
+    int entries[5] = { ptedit_paging_definition.pgd_entries, ptedit_paging_definition.p4d_entries,
+                       ptedit_paging_definition.pud_entries, ptedit_paging_definition.pmd_entries,
+                       ptedit_paging_definition.pt_entries };
+    int has[5] = { 1, ptedit_paging_definition.has_p4d, ptedit_paging_definition.has_pud, ptedit_paging_definition.has_pmd, 1 };
+    int shift = ptedit_paging_definition.page_offset, next, i;
+    size_t index, count, page;
+
+    for (i = level + 1; i < 5; i++) shift += entries[i];
+    for (next = level + 1; next < 5 && !has[next]; next++);
+
+    ptedit_read_physical_page(table / ptedit_pagesize, (char*)buffers[level]);
+    count = 1ull << entries[level];
+    /* Only the lower half of the root maps user space */
+    if (level == 0) count /= 2;
+
+    for (index = 0; index < count; index++) {
+        size_t entry = buffers[level][index];
+        size_t address = vaddr | (index << shift);
+        if (ptedit_cast(entry, ptedit_pgd_t).present != PTEDIT_PAGE_PRESENT) continue;
+        if (level == 4 || (level >= 2 && ptedit_cast(entry, ptedit_pgd_t).size)) {
+            size_t pages = 1ull << (shift - ptedit_paging_definition.page_offset);
+            /* Bit 12 is the PAT bit of large pages */
+            size_t pfn = ptedit_get_pfn(entry) & ~(pages - 1);
+            for (page = 0; page < pages; page++) {
+                if (ptedit_rmap_add(list, pfn + page, pid, address + page * ptedit_pagesize)) return -1;
+            }
+        }
+        else if (ptedit_rmap_walk(list, pid, ptedit_get_pfn(entry) * ptedit_pagesize, next, address, buffers)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+static int ptedit_rmap_is_user_process(pid_t pid) {
+    char path[64];
+    size_t size = 0;
+    FILE* f;
+    /* Kernel threads have no memory of their own */
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+    f = fopen(path, "r");
+    if (!f) return 0;
+    if (fscanf(f, "%zu", &size) != 1) size = 0;
+    fclose(f);
+    return size != 0;
+}
+
+
+// ---------------------------------------------------------------------------
+static void* ptedit_rmap_worker(void* arg) {
+    ptedit_rmap_worker_t* worker = (ptedit_rmap_worker_t*)arg;
+    ptedit_rmap_job_t* job = worker->job;
+    ptedit_rmap_list_t* list = &worker->list;
+    size_t* buffers[5];
+    size_t index;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+        buffers[i] = (size_t*)malloc(ptedit_pagesize);
+    }
+    while ((index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        pid_t pid = job->pids[index];
+        size_t root;
+        /* A partial index would silently miss mappings */
+        if (!buffers[0] || !buffers[1] || !buffers[2] || !buffers[3] || !buffers[4]) {
+            worker->failed = 1;
+            break;
+        }
+        if (!ptedit_rmap_is_user_process(pid)) continue;
+        root = ptedit_get_paging_root(pid);
+        if (root && ptedit_rmap_walk(list, (size_t)pid, root, 0, 0, buffers)) {
+            worker->failed = 1;
+            break;
+        }
+    }
+    for (i = 0; i < 5; i++) {
+        free(buffers[i]);
+    }
+    return NULL;
+}
+
+
+// ---------------------------------------------------------------------------
+static int ptedit_rmap_compare(const void* a, const void* b) {
+    const ptedit_rmap_tuple_t* x = (const ptedit_rmap_tuple_t*)a;
+    const ptedit_rmap_tuple_t* y = (const ptedit_rmap_tuple_t*)b;
+    if (x->pfn != y->pfn) return x->pfn < y->pfn ? -1 : 1;
+    if (x->pid != y->pid) return x->pid < y->pid ? -1 : 1;
+    if (x->vaddr != y->vaddr) return x->vaddr < y->vaddr ? -1 : 1;
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+static int ptedit_rmap_collect(const pid_t* pids, size_t count, int nthreads, ptedit_rmap_list_t* result) {
+    ptedit_rmap_job_t job;
+    ptedit_rmap_worker_t* workers;
+    pthread_t* threads;
+    int i, failed = 0;
+
+    if (nthreads <= 0) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0) nthreads = 1;
+
+    job.pids = pids;
+    job.count = count;
+    job.next = 0;
+    workers = (ptedit_rmap_worker_t*)calloc((size_t)nthreads, sizeof(ptedit_rmap_worker_t));
+    threads = (pthread_t*)calloc((size_t)nthreads, sizeof(pthread_t));
+    if (!workers || !threads) {
+        free(workers);
+        free(threads);
+        return -1;
+    }
+    for (i = 0; i < nthreads; i++) {
+        workers[i].job = &job;
+        if (pthread_create(&threads[i], NULL, ptedit_rmap_worker, &workers[i])) {
+            ptedit_rmap_worker(&workers[i]);
+            threads[i] = 0;
+        }
+    }
+    for (i = 0; i < nthreads; i++) {
+        if (threads[i]) pthread_join(threads[i], NULL);
+    }
+
+    memset(result, 0, sizeof(*result));
+    for (i = 0; i < nthreads; i++) {
+        result->capacity += workers[i].list.count;
+        failed |= workers[i].failed;
+    }
+    if (!failed) result->data = (ptedit_rmap_tuple_t*)malloc((result->capacity ? result->capacity : 1) * sizeof(ptedit_rmap_tuple_t));
+    for (i = 0; i < nthreads; i++) {
+        if (result->data) {
+            memcpy(result->data + result->count, workers[i].list.data, workers[i].list.count * sizeof(ptedit_rmap_tuple_t));
+            result->count += workers[i].list.count;
+        }
+        free(workers[i].list.data);
+    }
+    free(workers);
+    free(threads);
+    if (!result->data) return -1;
+    qsort(result->data, result->count, sizeof(ptedit_rmap_tuple_t), ptedit_rmap_compare);
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+static int ptedit_rmap_install(ptedit_rmap_list_t* list) {
+    size_t i, runs = 0;
+    ptedit_rmap_entry_t* entries = (ptedit_rmap_entry_t*)malloc((list->count ? list->count : 1) * sizeof(ptedit_rmap_entry_t));
+    size_t* run_pfn = (size_t*)malloc((list->count ? list->count : 1) * sizeof(size_t));
+    size_t* run_start = (size_t*)malloc((list->count + 1) * sizeof(size_t));
+    if (!entries || !run_pfn || !run_start) {
+        free(entries);
+        free(run_pfn);
+        free(run_start);
+        return -1;
+    }
+    for (i = 0; i < list->count; i++) {
+        if (!i || list->data[i].pfn != list->data[i - 1].pfn) {
+            run_pfn[runs] = list->data[i].pfn;
+            run_start[runs] = i;
+            runs++;
+        }
+        entries[i].pid = list->data[i].pid;
+        entries[i].vaddr = list->data[i].vaddr;
+    }
+    run_start[runs] = list->count;
+
+    free(ptedit_rmap.entries);
+    free(ptedit_rmap.run_pfn);
+    free(ptedit_rmap.run_start);
+    ptedit_rmap.entries = entries;
+    ptedit_rmap.count = list->count;
+    ptedit_rmap.run_pfn = run_pfn;
+    ptedit_rmap.run_start = run_start;
+    ptedit_rmap.runs = runs;
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+int ptedit_rmap_build(int nthreads) {
+    ptedit_rmap_list_t list;
+    pid_t* pids = NULL;
+    size_t count = 0;
+    struct dirent* de;
+    DIR* proc = opendir("/proc");
+    int ret;
+
+    if (!proc) return -1;
+    while ((de = readdir(proc))) {
+        char* end;
+        long pid = strtol(de->d_name, &end, 10);
+        pid_t* grown;
+        if (*end || pid <= 0) continue;
+        grown = (pid_t*)realloc(pids, (count + 1) * sizeof(pid_t));
+        if (!grown) {
+            closedir(proc);
+            free(pids);
+            return -1;
+        }
+        pids = grown;
+        pids[count++] = (pid_t)pid;
+    }
+    closedir(proc);
+
+    ret = ptedit_rmap_collect(pids, count, nthreads, &list);
+    free(pids);
+    if (ret) return ret;
+
+    pthread_mutex_lock(&ptedit_rmap_lock);
+    ret = ptedit_rmap_install(&list);
+    pthread_mutex_unlock(&ptedit_rmap_lock);
+    free(list.data);
+    return ret;
+}
+
+
+// ---------------------------------------------------------------------------
+int ptedit_rmap_refresh(const pid_t* pids, size_t count) {
+    ptedit_rmap_list_t fresh, merged;
+    size_t run, i, j;
+    int ret;
+
+    ret = ptedit_rmap_collect(pids, count, 0, &fresh);
+    if (ret) return ret;
+
+    ret = -1;
+    pthread_mutex_lock(&ptedit_rmap_lock);
+    /* Merge the fresh mappings with all existing mappings of other processes */
+    memset(&merged, 0, sizeof(merged));
+    j = 0;
+    for (run = 0; run < ptedit_rmap.runs; run++) {
+        for (i = ptedit_rmap.run_start[run]; i < ptedit_rmap.run_start[run + 1]; i++) {
+            ptedit_rmap_tuple_t old;
+            size_t k;
+            int refreshed = 0;
+            for (k = 0; k < count; k++) {
+                if (ptedit_rmap.entries[i].pid == (size_t)pids[k]) refreshed = 1;
+            }
+            if (refreshed) continue;
+            old.pfn = ptedit_rmap.run_pfn[run];
+            old.pid = ptedit_rmap.entries[i].pid;
+            old.vaddr = ptedit_rmap.entries[i].vaddr;
+            while (j < fresh.count && ptedit_rmap_compare(&fresh.data[j], &old) < 0) {
+                if (ptedit_rmap_add(&merged, fresh.data[j].pfn, fresh.data[j].pid, fresh.data[j].vaddr)) goto out;
+                j++;
+            }
+            if (ptedit_rmap_add(&merged, old.pfn, old.pid, old.vaddr)) goto out;
+        }
+    }
+    for (; j < fresh.count; j++) {
+        if (ptedit_rmap_add(&merged, fresh.data[j].pfn, fresh.data[j].pid, fresh.data[j].vaddr)) goto out;
+    }
+    ret = ptedit_rmap_install(&merged);
+    /* On failure, the previous index stays in place */
+out:
+    pthread_mutex_unlock(&ptedit_rmap_lock);
+
+    free(fresh.data);
+    free(merged.data);
+    return ret;
+}
+
+
+// ---------------------------------------------------------------------------
+size_t ptedit_rmap_lookup(size_t pfn, const ptedit_rmap_entry_t** mappings) {
+    size_t low = 0, high, count = 0;
+    pthread_mutex_lock(&ptedit_rmap_lock);
+    high = ptedit_rmap.runs;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (ptedit_rmap.run_pfn[mid] < pfn) low = mid + 1;
+        else high = mid;
+    }
+    if (mappings) *mappings = NULL;
+    if (low < ptedit_rmap.runs && ptedit_rmap.run_pfn[low] == pfn) {
+        if (mappings) *mappings = &ptedit_rmap.entries[ptedit_rmap.run_start[low]];
+        count = ptedit_rmap.run_start[low + 1] - ptedit_rmap.run_start[low];
+    }
+    pthread_mutex_unlock(&ptedit_rmap_lock);
+    return count;
+}
+
+
+// ---------------------------------------------------------------------------
+void ptedit_rmap_free() {
+    pthread_mutex_lock(&ptedit_rmap_lock);
+    free(ptedit_rmap.entries);
+    free(ptedit_rmap.run_pfn);
+    free(ptedit_rmap.run_start);
+    memset(&ptedit_rmap, 0, sizeof(ptedit_rmap));
+    pthread_mutex_unlock(&ptedit_rmap_lock);
+}
+
+
+// ---------------------------------------------------------------------------
+int ptedit_rmap_query(const size_t* pfns, size_t count, size_t max_mappings, size_t* found, ptedit_rmap_entry_t* mappings) {
+    ptedit_rmap_query_t query;
+    query.count = count;
+    query.max_mappings = max_mappings;
+    query.pfns = (size_t*)pfns;
+    query.found = found;
+    query.mappings = mappings;
+    return ioctl(ptedit_fd, PTEDITOR_IOCTL_CMD_RMAP_QUERY, (size_t)&query) ? -1 : 0;
+}
+
+
+// ---------------------------------------------------------------------------
+#if defined(PTEDIT_HAS_IO_URING)
+
+#define PTEDIT_ASYNC_READ    0
+#define PTEDIT_ASYNC_RESOLVE 1
+
+typedef struct {
+    size_t remaining;
+    int result;
+    ptedit_async_callback_t callback;
+    void* context;
+} ptedit_async_batch_t;
+
+typedef struct {
+    int type;
+    /* Read of a run of consecutive pages */
+    ptedit_async_batch_t* batch;
+    int nr;
+    struct iovec* iov;
+    /* Resolve: one entry of the page-table walk at a time */
+    struct iovec value_iov;
+    size_t value;
+    int level;
+    ptedit_entry_t* entry;
+    ptedit_async_callback_t callback;
+    void* context;
+} ptedit_async_request_t;
+
+static struct {
+    int fd;
+    unsigned depth, inflight, queued;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    size_t completed;
+} ptedit_async = { .fd = -1 };
+
+
+// ---------------------------------------------------------------------------
+int ptedit_async_init(unsigned int depth) {
+    struct io_uring_params params;
+    if (ptedit_async.fd >= 0) return 0;
+    if (ptedit_umem <= 0 || !depth) return -1;
+
+    memset(&params, 0, sizeof(params));
+    ptedit_async.fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+    if (ptedit_async.fd < 0) return -1;
+
+    ptedit_async.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ptedit_async.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ptedit_async.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ptedit_async.sq_ring = mmap(0, ptedit_async.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ptedit_async.fd, IORING_OFF_SQ_RING);
+    ptedit_async.cq_ring = mmap(0, ptedit_async.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ptedit_async.fd, IORING_OFF_CQ_RING);
+    ptedit_async.sqes = (struct io_uring_sqe*)mmap(0, ptedit_async.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ptedit_async.fd, IORING_OFF_SQES);
+    if (ptedit_async.sq_ring == MAP_FAILED || ptedit_async.cq_ring == MAP_FAILED || ptedit_async.sqes == MAP_FAILED) {
+        ptedit_async_cleanup();
+        return -1;
+    }
+
+    ptedit_async.sq_tail = (unsigned*)((char*)ptedit_async.sq_ring + params.sq_off.tail);
+    ptedit_async.sq_mask = (unsigned*)((char*)ptedit_async.sq_ring + params.sq_off.ring_mask);
+    ptedit_async.sq_array = (unsigned*)((char*)ptedit_async.sq_ring + params.sq_off.array);
+    ptedit_async.cq_head = (unsigned*)((char*)ptedit_async.cq_ring + params.cq_off.head);
+    ptedit_async.cq_tail = (unsigned*)((char*)ptedit_async.cq_ring + params.cq_off.tail);
+    ptedit_async.cq_mask = (unsigned*)((char*)ptedit_async.cq_ring + params.cq_off.ring_mask);
+    ptedit_async.cqes = (struct io_uring_cqe*)((char*)ptedit_async.cq_ring + params.cq_off.cqes);
+    /* Never more operations in flight than submission entries, so neither ring can overflow */
+    ptedit_async.depth = params.sq_entries;
+    ptedit_async.inflight = 0;
+    ptedit_async.queued = 0;
+    ptedit_async.completed = 0;
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+void ptedit_async_cleanup() {
+    if (ptedit_async.fd < 0) return;
+    while (ptedit_async.inflight) {
+        if (!ptedit_async_wait(1)) break;
+    }
+    if (ptedit_async.sq_ring && ptedit_async.sq_ring != MAP_FAILED) munmap(ptedit_async.sq_ring, ptedit_async.sq_ring_size);
+    if (ptedit_async.cq_ring && ptedit_async.cq_ring != MAP_FAILED) munmap(ptedit_async.cq_ring, ptedit_async.cq_ring_size);
+    if (ptedit_async.sqes && (void*)ptedit_async.sqes != MAP_FAILED) munmap(ptedit_async.sqes, ptedit_async.sqes_size);
+    close(ptedit_async.fd);
+    memset(&ptedit_async, 0, sizeof(ptedit_async));
+    ptedit_async.fd = -1;
+}
+
+
+// ---------------------------------------------------------------------------
+static int ptedit_async_enter(unsigned min_complete) {
+    int ret = (int)syscall(__NR_io_uring_enter, ptedit_async.fd, ptedit_async.queued, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret > 0) ptedit_async.queued -= (unsigned)ret;
+    return ret;
+}
+
+
+// ---------------------------------------------------------------------------
+static void ptedit_async_complete(ptedit_async_request_t* request, int result);
+
+static size_t ptedit_async_reap() {
+    size_t before = ptedit_async.completed;
+    unsigned head;
+    /* Callbacks can re-enter the API and reap completions themselves, the head is only valid until the next callback */
+    while ((head = __atomic_load_n(ptedit_async.cq_head, __ATOMIC_RELAXED)) != __atomic_load_n(ptedit_async.cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe* cqe = &ptedit_async.cqes[head & *ptedit_async.cq_mask];
+        ptedit_async_request_t* request = (ptedit_async_request_t*)(size_t)cqe->user_data;
+        int result = cqe->res;
+        head++;
+        __atomic_store_n(ptedit_async.cq_head, head, __ATOMIC_RELEASE);
+        /* Free the slot before the callback, a resolve step queues its next read */
+        ptedit_async.inflight--;
+        ptedit_async_complete(request, result);
+    }
+    return ptedit_async.completed - before;
+}
+
+
+// ---------------------------------------------------------------------------
+static int ptedit_async_queue(ptedit_async_request_t* request, struct iovec* iov, int nr, size_t offset) {
+    unsigned tail, index;
+    struct io_uring_sqe* sqe;
+
+    while (ptedit_async.inflight >= ptedit_async.depth) {
+        if (ptedit_async_enter(1) < 0) return -1;
+        ptedit_async_reap();
+    }
+
+    tail = *ptedit_async.sq_tail;
+    index = tail & *ptedit_async.sq_mask;
+    sqe = &ptedit_async.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = ptedit_umem;
+    sqe->off = offset;
+    sqe->addr = (size_t)iov;
+    sqe->len = (unsigned)nr;
+    sqe->user_data = (size_t)request;
+    ptedit_async.sq_array[index] = index;
+    __atomic_store_n(ptedit_async.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ptedit_async.inflight++;
+    ptedit_async.queued++;
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+static size_t ptedit_async_index(size_t address, int level) {
+    int entries[5] = { ptedit_paging_definition.pgd_entries, ptedit_paging_definition.p4d_entries,
+                       ptedit_paging_definition.pud_entries, ptedit_paging_definition.pmd_entries,
+                       ptedit_paging_definition.pt_entries };
+    int shift = ptedit_paging_definition.page_offset, i;
+    for (i = level + 1; i < 5; i++) shift += entries[i];
+    return (address >> shift) % (1ull << entries[level]);
+}
+
+
+// ---------------------------------------------------------------------------
+static int ptedit_async_resolve_step(ptedit_async_request_t* request) {
+    size_t* fields[5] = { &request->entry->pgd, &request->entry->p4d, &request->entry->pud, &request->entry->pmd, &request->entry->pte };
+    size_t masks[5] = { PTEDIT_VALID_MASK_PGD, PTEDIT_VALID_MASK_P4D, PTEDIT_VALID_MASK_PUD, PTEDIT_VALID_MASK_PMD, PTEDIT_VALID_MASK_PTE };
+    int has[5] = { 1, ptedit_paging_definition.has_p4d, ptedit_paging_definition.has_pud, ptedit_paging_definition.has_pmd, 1 };
+    size_t value = request->value;
+    int level = request->level;
+
+    *fields[level] = value;
+    request->entry->valid |= masks[level];
+    if (ptedit_cast(value, ptedit_pgd_t).present != PTEDIT_PAGE_PRESENT || level == 4) return 1;
+    /* Large pages end the walk */
+    if (level >= 2 && ptedit_cast(value, ptedit_pgd_t).size) return 1;
+
+    for (level++; !has[level]; level++) {
+        *fields[level] = value;
+    }
+    request->level = level;
+    return ptedit_async_queue(request, &request->value_iov, 1,
+        (size_t)ptedit_cast(value, ptedit_pgd_t).pfn * ptedit_pagesize + ptedit_async_index(request->entry->vaddr, level) * sizeof(size_t)) ? -1 : 0;
+}
+
+
+// ---------------------------------------------------------------------------
+static void ptedit_async_complete(ptedit_async_request_t* request, int result) {
+    if (request->type == PTEDIT_ASYNC_READ) {
+        ptedit_async_batch_t* batch = request->batch;
+        if (result >= 0 && (size_t)result != request->nr * (size_t)ptedit_pagesize) result = -EIO;
+        if (result < 0 && !batch->result) batch->result = result;
+        free(request->iov);
+        free(request);
+        if (--batch->remaining == 0) {
+            if (batch->callback) batch->callback(batch->context, batch->result);
+            free(batch);
+            ptedit_async.completed++;
+        }
+    }
+    else {
+        /* A short read leaves a stale entry in the request */
+        int done = (result < 0) ? result : (result != (int)sizeof(request->value)) ? -EIO : ptedit_async_resolve_step(request);
+        if (done) {
+            if (request->callback) request->callback(request->context, done < 0 ? done : 0);
+            free(request);
+            ptedit_async.completed++;
+        }
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+int ptedit_async_read_pages(const size_t* pfns, char** buffers, size_t count, ptedit_async_callback_t callback, void* context) {
+    ptedit_async_batch_t* batch;
+    size_t i, j, k;
+    if (ptedit_async.fd < 0) return -1;
+    if (!count) {
+        if (callback) callback(context, 0);
+        return 0;
+    }
+
+    batch = (ptedit_async_batch_t*)calloc(1, sizeof(ptedit_async_batch_t));
+    if (!batch) return -1;
+    batch->callback = callback;
+    batch->context = context;
+    /* Keep the batch alive until every run is queued */
+    batch->remaining = 1;
+
+    for (i = 0; i < count; i = j) {
+        ptedit_async_request_t* request = (ptedit_async_request_t*)calloc(1, sizeof(ptedit_async_request_t));
+        for (j = i; j < count && j - i < PTEDIT_IOV_MAX && pfns[j] == pfns[i] + (j - i); j++);
+        if (request) request->iov = (struct iovec*)malloc((j - i) * sizeof(struct iovec));
+        if (!request || !request->iov) {
+            free(request);
+            batch->result = -1;
+            break;
+        }
+        request->type = PTEDIT_ASYNC_READ;
+        request->batch = batch;
+        request->nr = (int)(j - i);
+        for (k = i; k < j; k++) {
+            request->iov[k - i].iov_base = buffers[k];
+            request->iov[k - i].iov_len = ptedit_pagesize;
+        }
+        batch->remaining++;
+        if (ptedit_async_queue(request, request->iov, request->nr, pfns[i] * ptedit_pagesize)) {
+            batch->remaining--;
+            free(request->iov);
+            free(request);
+            batch->result = -1;
+            break;
+        }
+    }
+
+    if (--batch->remaining == 0) {
+        if (callback) callback(context, batch->result);
+        free(batch);
+        ptedit_async.completed++;
+    }
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+int ptedit_async_resolve(void* address, pid_t pid, ptedit_entry_t* entry, ptedit_async_callback_t callback, void* context) {
+    size_t root = (pid == 0 && ptedit_paging_root) ? ptedit_paging_root : ptedit_get_paging_root(pid);
+    ptedit_async_request_t* request;
+    if (ptedit_async.fd < 0) return -1;
+
+    memset(entry, 0, sizeof(*entry));
+    entry->vaddr = (size_t)address;
+    entry->pid = (size_t)pid;
+    if (!root) {
+        if (callback) callback(context, 0);
+        return 0;
+    }
+
+    request = (ptedit_async_request_t*)calloc(1, sizeof(ptedit_async_request_t));
+    if (!request) return -1;
+    request->type = PTEDIT_ASYNC_RESOLVE;
+    request->entry = entry;
+    request->level = 0;
+    request->value_iov.iov_base = &request->value;
+    request->value_iov.iov_len = sizeof(request->value);
+    request->callback = callback;
+    request->context = context;
+    if (ptedit_async_queue(request, &request->value_iov, 1, root + ptedit_async_index((size_t)address, 0) * sizeof(size_t))) {
+        free(request);
+        return -1;
+    }
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+int ptedit_async_submit() {
+    if (ptedit_async.fd < 0) return -1;
+    return ptedit_async_enter(0) < 0 ? -1 : 0;
+}
+
+
+// ---------------------------------------------------------------------------
+size_t ptedit_async_wait(size_t min_complete) {
+    size_t completed = 0;
+    if (ptedit_async.fd < 0) return 0;
+    if (ptedit_async.queued && ptedit_async_enter(0) < 0) return 0;
+    completed += ptedit_async_reap();
+    while (completed < min_complete && ptedit_async.inflight) {
+        if (ptedit_async_enter(1) < 0) break;
+        completed += ptedit_async_reap();
+    }
+    return completed;
+}
+
+#else
+
+// ---------------------------------------------------------------------------
+int ptedit_async_init(unsigned int depth) {
+    (void)depth;
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+void ptedit_async_cleanup() {
+}
+
+// ---------------------------------------------------------------------------
+int ptedit_async_read_pages(const size_t* pfns, char** buffers, size_t count, ptedit_async_callback_t callback, void* context) {
+    (void)pfns; (void)buffers; (void)count; (void)callback; (void)context;
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+int ptedit_async_resolve(void* address, pid_t pid, ptedit_entry_t* entry, ptedit_async_callback_t callback, void* context) {
+    (void)address; (void)pid; (void)entry; (void)callback; (void)context;
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+int ptedit_async_submit() {
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+size_t ptedit_async_wait(size_t min_complete) {
+    (void)min_complete;
+    return 0;
+}
+
+#endif
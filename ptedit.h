@@ -3,6 +3,7 @@
 #pragma once
 #include "module/pteditor.h"
 #include <sys/types.h>
+#include <stdint.h>
 
 /**
  * The implementation of PTEditor to use
@@ -18,6 +19,8 @@
 #define PTEDIT_IMPL_USER_PREAD   1
 /** Use the user-space implemenation that maps the physical memory into user space to resolve and update paging structures */
 #define PTEDIT_IMPL_USER         2
+/** Use a simulated MMU with synthetic page tables in simulated physical memory, does not require the kernel module (see ptedit_sim_init) */
+#define PTEDIT_IMPL_SIM          3
 
 /**
  * The bits in a page-table entry
@@ -120,7 +123,7 @@ void ptedit_cleanup();
 /**
  * Switch between kernel and user-space implementation
  *
- * @param[in] implementation The implementation to use, either PTEDIT_IMPL_KERNEL, PTEDIT_IMPL_USER, or PTEDIT_IMPL_USER_PREAD
+ * @param[in] implementation The implementation to use, either PTEDIT_IMPL_KERNEL, PTEDIT_IMPL_USER, PTEDIT_IMPL_USER_PREAD, or PTEDIT_IMPL_SIM
  *
  */
 void ptedit_use_implementation(int implementation);
@@ -148,7 +151,7 @@ typedef void (*ptedit_update_t)(void*, pid_t, ptedit_entry_t*);
 
 
 /**
- * Sets a bit directly in the PTE of an address.
+ * Sets a bit directly in the PTE of an address, atomically with the kernel implementation (see ptedit_pte_fetch_or).
  *
  * @param[in] address The virtual address
  * @param[in] pid The pid of the process (0 for own process)
@@ -158,7 +161,7 @@ typedef void (*ptedit_update_t)(void*, pid_t, ptedit_entry_t*);
 void ptedit_pte_set_bit(void* address, pid_t pid, int bit);
 
 /**
- * Clears a bit directly in the PTE of an address.
+ * Clears a bit directly in the PTE of an address, atomically with the kernel implementation (see ptedit_pte_fetch_andnot).
  *
  * @param[in] address The virtual address
  * @param[in] pid The pid of the process (0 for own process)
@@ -167,6 +170,56 @@ void ptedit_pte_set_bit(void* address, pid_t pid, int bit);
  */
 void ptedit_pte_clear_bit(void* address, pid_t pid, int bit);
 
+/**
+ * Sets and clears bits in the entries of all pages in a virtual range with a single call and a single TLB invalidation.
+ * Huge pages overlapping the range are changed as a whole.
+ * The masks are in the format of a PTE and must not contain PFN bits. In huge pages, the page-size bit is kept and the PAT bit is moved to its position in huge entries.
+ *
+ * @param[in] address The virtual address of the range
+ * @param[in] length The length of the range in bytes
+ * @param[in] pid The pid of the process (0 for own process)
+ * @param[in] set_mask The bits to set
+ * @param[in] clear_mask The bits to clear
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int ptedit_range_modify_bits(void* address, size_t length, pid_t pid, size_t set_mask, size_t clear_mask);
+
+/**
+ * Atomically replaces page-table entries if they still have the expected value, e.g., to not lose accessed or dirty bits the hardware set in between.
+ * The kernel implementation uses a single compare-and-swap per entry, the other implementations fall back to a resolve followed by an update.
+ *
+ * @param[in] address The virtual address
+ * @param[in] pid The pid of the process (0 for own process)
+ * @param[in,out] expected The expected entries, receives the previous entries
+ * @param[in] desired The new entries, valid selects the entries to replace
+ *
+ * @return A bitmask of the replaced entries (PTEDIT_VALID_MASK_*), -1 on error
+ */
+int ptedit_cmpxchg(void* address, pid_t pid, ptedit_entry_t* expected, ptedit_entry_t* desired);
+
+/**
+ * Atomically sets bits in the PTE of an address.
+ *
+ * @param[in] address The virtual address
+ * @param[in] pid The pid of the process (0 for own process)
+ * @param[in] bits The bits to set
+ *
+ * @return The previous PTE, 0 if there is no PTE
+ */
+size_t ptedit_pte_fetch_or(void* address, pid_t pid, size_t bits);
+
+/**
+ * Atomically clears bits in the PTE of an address.
+ *
+ * @param[in] address The virtual address
+ * @param[in] pid The pid of the process (0 for own process)
+ * @param[in] bits The bits to clear
+ *
+ * @return The previous PTE, 0 if there is no PTE
+ */
+size_t ptedit_pte_fetch_andnot(void* address, pid_t pid, size_t bits);
+
 /**
  * Returns the value of a bit directly from the PTE of an address.
  *
@@ -200,6 +253,38 @@ size_t ptedit_pte_get_pfn(void* address, pid_t pid);
  */
 void ptedit_pte_set_pfn(void* address, pid_t pid, size_t pfn);
 
+/**
+ * Maps a virtual range onto the frames of another range of the same process, e.g., to map a ring buffer twice.
+ * The PFN and all attribute bits of every source PTE are copied to the destination PTE in a single call with a single TLB invalidation.
+ * The destination has to lie within one existing mapping and must not be populated yet; all source pages have to be present and mapped with 4 kB pages.
+ * If any page cannot be aliased, no page of the range stays mapped.
+ * The frames are reference counted and released again when the destination is unmapped.
+ *
+ * @param[in] dst The page-aligned virtual address of the destination range
+ * @param[in] src The page-aligned virtual address of the source range
+ * @param[in] length The length of the ranges in bytes
+ * @param[in] pid The pid of the process (0 for own process)
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int ptedit_alias_range(void* dst, void* src, size_t length, pid_t pid);
+
+/**
+ * Maps a virtual range of one process onto the frames of a range of another process, e.g., to transfer large buffers without copying.
+ * Works like ptedit_alias_range, only the TLB of the destination process is invalidated. The destination has to be reserved beforehand (e.g., with mmap) and must not be populated yet.
+ * If any page cannot be shared, no page of the range stays mapped.
+ * Pages that are copy-on-write in the source (e.g., after fork) are mapped read-only, writes to them are not shared.
+ *
+ * @param[in] src_pid The pid of the source process (0 for own process)
+ * @param[in] src_addr The page-aligned virtual address of the source range
+ * @param[in] dst_pid The pid of the destination process (0 for own process)
+ * @param[in] dst_addr The page-aligned virtual address of the destination range
+ * @param[in] length The length of the ranges in bytes
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int ptedit_share_range(pid_t src_pid, void* src_addr, pid_t dst_pid, void* dst_addr, size_t length);
+
 
 #define PTEDIT_PAGE_PRESENT 1
 
@@ -382,20 +467,254 @@ void ptedit_read_physical_page(size_t pfn, char* buffer);
 void ptedit_write_physical_page(size_t pfn, char* content);
 
 /**
- * Map a physical address range.
+ * Retrieves the content of a physically contiguous range, e.g., an entire 2MB or 1GB page, with a single call.
+ *
+ * @param[in] pfn The page-frame number (PFN) of the first page to read
+ * @param[out] buffer A buffer which is large enough to hold the content of the range
+ * @param[in] length The length of the range in bytes
+ *
+ */
+void ptedit_read_physical_range(size_t pfn, char* buffer, size_t length);
+
+/**
+ * Replaces the content of a physically contiguous range, e.g., an entire 2MB or 1GB page, with a single call.
+ *
+ * @param[in] pfn The page-frame number (PFN) of the first page to update
+ * @param[in] content A buffer containing the new content of the range
+ * @param[in] length The length of the range in bytes
+ *
+ */
+void ptedit_write_physical_range(size_t pfn, char* content, size_t length);
+
+/**
+ * Retrieves the content of multiple physical pages with as few system calls as possible.
+ *
+ * @param[in] pfns The page-frame numbers (PFNs) of the pages to read
+ * @param[out] buffers One buffer per page, each large enough to hold the content of a page
+ * @param[in] count The number of pages to read
+ *
+ */
+void ptedit_read_physical_pages(const size_t* pfns, char** buffers, size_t count);
+
+/**
+ * Replaces the content of multiple physical pages with as few system calls as possible.
+ *
+ * @param[in] pfns The page-frame numbers (PFNs) of the pages to update
+ * @param[in] contents One buffer per page containing the new content of the page
+ * @param[in] count The number of pages to update
+ *
+ */
+void ptedit_write_physical_pages(const size_t* pfns, char** contents, size_t count);
+
+/**
+ * Map a physical address range. The range is mapped through the PTEditor device, which uses 2MB and 1GB pages
+ * where the physical address is suitably aligned (Linux 5.8 or newer with transparent huge pages), or through /proc/umem as a fallback.
+ * Frames outside of RAM (e.g., MMIO) are mapped uncached with 4kB pages.
+ * Mappings are made in aligned 2MB windows which are shared by all calls for addresses in the same window.
  *
  * @param[in] physical The physical address to map
  * @param[in] length The length of the physical memory range to map
  *
- * @return A virtual address that can be used to access the physical range
+ * @return A virtual address that can be used to access the physical range, or NULL on failure
  */
 void* ptedit_pmap(size_t physical, size_t length);
 
+/**
+ * Releases a range mapped with ptedit_pmap. The window stays cached and is only unmapped
+ * when too many unused windows accumulate, least-recently used first.
+ *
+ * @param[in] address The address returned by ptedit_pmap
+ * @param[in] length The length that was passed to ptedit_pmap
+ */
+void ptedit_punmap(void* address, size_t length);
+
+/**
+ * Maps physically contiguous pages to a virtual address range of the current process in a single call.
+ * The range has to lie within one existing mapping (e.g., from mmap) and must not be populated yet, otherwise nothing is mapped.
+ * In mappings of the PTEditor device, 2MB pages are used where the virtual address and the PFN are suitably aligned
+ * (Linux 5.8 or newer with transparent huge pages). In other mappings, the pages are reference counted and released
+ * again when the range is unmapped.
+ *
+ * @param[in] vaddr The page-aligned virtual address of the first page
+ * @param[in] pfn The page-frame number (PFN) of the first page
+ * @param[in] npages The number of pages to map
+ * @param[in] flags The page-table entry bits of the mapping without the PFN or the huge-page bit (0 for present, writable, user-accessible, and non-executable)
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int ptedit_map_range(void* vaddr, size_t pfn, size_t npages, size_t flags);
+
+/**
+ * Called for every physical address where the pattern was found. Calls are serialized.
+ *
+ * @param[in] physical The physical address of the match
+ *
+ * @return 0 to continue searching, any other value to stop the search
+ */
+typedef int (*ptedit_phys_search_callback_t)(size_t physical);
+
+/**
+ * Searches all of System RAM (as listed in /proc/iomem) for a byte pattern. The memory is split into chunks per NUMA node
+ * and scanned by multiple threads, each pinned to the CPUs of a node. Requires root to read /proc/iomem.
+ *
+ * @param[in] pattern The pattern to search for
+ * @param[in] length The length of the pattern in bytes
+ * @param[in] callback Function to call for every match (can be NULL to only count matches)
+ * @param[in] nthreads The number of threads to use (0 for one per online CPU)
+ *
+ * @return The number of matches, or -1 if the search could not be started
+ */
+ssize_t ptedit_phys_search(const void* pattern, size_t length, ptedit_phys_search_callback_t callback, int nthreads);
+
 /** @} */
 
 
 
 
+/**
+ * Reverse mapping from physical pages to the processes and virtual addresses that map them
+ *
+ * @defgroup RMAP Reverse mapping
+ *
+ * @{
+ */
+
+/**
+ * Builds the reverse-mapping index by walking the user-space page tables of all processes in parallel.
+ * Large pages are indexed with every page frame they contain.
+ *
+ * @param[in] nthreads The number of threads to use (0 for one per online CPU)
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int ptedit_rmap_build(int nthreads);
+
+/**
+ * Replaces the mappings of the given processes in the index with their current mappings.
+ *
+ * @param[in] pids The processes to walk again
+ * @param[in] count The number of processes
+ *
+ * @return 0 on success, -1 otherwise (e.g., out of memory), in which case the previous index is kept
+ */
+int ptedit_rmap_refresh(const pid_t* pids, size_t count);
+
+/**
+ * Looks up all virtual addresses which map a physical page in O(log n). The lookup itself is safe against concurrent
+ * changes of the index, but the returned mappings point into the index. They must not be used while another thread calls
+ * ptedit_rmap_build, ptedit_rmap_refresh, or ptedit_rmap_free.
+ *
+ * @param[in] pfn The page-frame number (PFN) to look up
+ * @param[out] mappings Receives a pointer to the mappings, sorted by pid and address (valid until the index is changed)
+ *
+ * @return The number of mappings of the page
+ */
+size_t ptedit_rmap_lookup(size_t pfn, const ptedit_rmap_entry_t** mappings);
+
+/**
+ * Releases the reverse-mapping index.
+ *
+ */
+void ptedit_rmap_free();
+
+/**
+ * Asks the kernel module which processes map the given physical pages, using the kernel's own reverse mapping.
+ * Does not require the reverse-mapping index. Pages that are free or not owned by the page allocator have no mappings.
+ *
+ * @param[in] pfns The page-frame numbers (PFN) to look up
+ * @param[in] count The number of page-frame numbers
+ * @param[in] max_mappings The maximum number of mappings to return per page
+ * @param[out] found Receives the number of mappings returned for every page (at most max_mappings)
+ * @param[out] mappings Receives the mappings of page i at mappings[i * max_mappings] (count * max_mappings entries). Pids are 0 if the owner of an address space is unknown.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int ptedit_rmap_query(const size_t* pfns, size_t count, size_t max_mappings, size_t* found, ptedit_rmap_entry_t* mappings);
+
+/** @} */
+
+
+/**
+ * Asynchronous physical memory I/O using io_uring on /proc/umem.
+ * Callbacks run on the calling thread, either in ptedit_async_wait or while queueing a new operation when the queue is full.
+ *
+ * @defgroup ASYNC Asynchronous I/O
+ *
+ * @{
+ */
+
+/**
+ * Called when an asynchronous operation has completed.
+ *
+ * @param[in] context The context passed when the operation was started
+ * @param[in] result 0 on success, a negative error code otherwise
+ */
+typedef void (*ptedit_async_callback_t)(void* context, int result);
+
+/**
+ * Sets up the io_uring used for asynchronous operations. Requires /proc/umem.
+ *
+ * @param[in] depth The maximum number of physical reads in flight
+ *
+ * @return 0 Initialization was successful
+ * @return -1 Initialization failed or io_uring is not supported
+ */
+int ptedit_async_init(unsigned int depth);
+
+/**
+ * Waits for all outstanding asynchronous operations and releases the io_uring.
+ *
+ */
+void ptedit_async_cleanup();
+
+/**
+ * Queues reads of multiple physical pages. Runs of consecutive frames are combined into a single read.
+ * The callback is invoked once all pages are read.
+ *
+ * @param[in] pfns The page-frame numbers (PFNs) of the pages to read
+ * @param[out] buffers One buffer per page, each large enough to hold the content of a page (must stay valid until completion)
+ * @param[in] count The number of pages to read
+ * @param[in] callback Function to call on completion (can be NULL)
+ * @param[in] context Passed to the callback
+ *
+ * @return 0 if the reads were queued, -1 otherwise
+ */
+int ptedit_async_read_pages(const size_t* pfns, char** buffers, size_t count, ptedit_async_callback_t callback, void* context);
+
+/**
+ * Queues a page-table walk as done by PTEDIT_IMPL_USER_PREAD. Every level is read asynchronously, such that many walks can
+ * be in flight at the same time. The callback is invoked once the walk is complete. The levels are not linked with
+ * IOSQE_IO_LINK, as each read needs the entry of the previous one; the next level is queued on completion instead.
+ *
+ * @param[in] address The virtual address to resolve
+ * @param[in] pid The pid of the process (0 for own process)
+ * @param[out] entry Receives the resolved entries (must stay valid until completion)
+ * @param[in] callback Function to call on completion (can be NULL)
+ * @param[in] context Passed to the callback
+ *
+ * @return 0 if the walk was queued, -1 otherwise
+ */
+int ptedit_async_resolve(void* address, pid_t pid, ptedit_entry_t* entry, ptedit_async_callback_t callback, void* context);
+
+/**
+ * Submits all queued operations to the kernel without waiting.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int ptedit_async_submit();
+
+/**
+ * Submits all queued operations and processes completions, invoking the callbacks.
+ *
+ * @param[in] min_complete The minimum number of operations to wait for (0 to only process finished operations)
+ *
+ * @return The number of operations that completed
+ */
+size_t ptedit_async_wait(size_t min_complete);
+
+/** @} */
+
+
 /**
  * Read and modify the root of paging structure
  *
@@ -415,7 +734,7 @@ void* ptedit_pmap(size_t physical, size_t length);
 size_t ptedit_get_paging_root(pid_t pid);
 
 /**
- * Sets the root of the paging structure (i.e., CR3 on x86 and TTBR0 on ARM).
+ * Sets the root of the paging structure (i.e., CR3 on x86 and TTBR0 on ARM). Roots returned by ptedit_clone_paging_root can only be installed in the process they were cloned from.
  *
  * @param[in] pid The proccess id (0 for own process)
  * @param[in] root The physical address (not PFN!) of the first page table (i.e., the PGD)
@@ -423,6 +742,189 @@ size_t ptedit_get_paging_root(pid_t pid);
  */
 void ptedit_set_paging_root(pid_t pid, size_t root);
 
+/**
+ * Clones the paging hierarchy of a process in a single call, e.g., to build an alternate view of the address space for ptedit_set_paging_root.
+ * Only the tables overlapping the range are copied, all other entries, including the kernel part, point to the original tables.
+ * Tables of the levels in shared_levels (and below) are not copied but shared with the original. The pages themselves are never copied or reference counted.
+ * While the clone is installed, the root it replaced is kept and restored when the clone is destroyed, the module is unloaded, or the process exits.
+ * Tables the kernel allocates within the range while the clone is installed are only linked into the clone.
+ *
+ * @param[in] pid The proccess id (0 for own process)
+ * @param[in] address The virtual address of the range to clone
+ * @param[in] length The length of the range in bytes (0 for the whole user address space)
+ * @param[in] shared_levels The levels whose tables are shared (PTEDIT_VALID_MASK_*), 0 to copy all tables down to the page tables
+ *
+ * @return The physical address (not PFN!) of the new root, 0 on error
+ */
+size_t ptedit_clone_paging_root(pid_t pid, void* address, size_t length, size_t shared_levels);
+
+/**
+ * Frees a paging hierarchy returned by ptedit_clone_paging_root. If it is installed, the root it replaced is restored first.
+ *
+ * @param[in] root The physical address of the cloned root
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int ptedit_destroy_paging_root(size_t root);
+
+/** @} */
+
+
+/**
+ * Simulated MMU, to test and profile the library without the kernel module
+ *
+ * @defgroup SIM Simulated MMU
+ *
+ * @{
+ */
+
+/** Allocate a fresh frame from the simulated physical memory (for ptedit_sim_map) */
+#define PTEDIT_SIM_ALLOC ((size_t)-1)
+
+/**
+ * Sets up a simulated x86-64 MMU with 4-level page tables and selects PTEDIT_IMPL_SIM. The physical memory is backed by a file
+ * or an anonymous mapping, the page tables are synthetic and initially empty. Resolving, updating, reading and writing physical
+ * pages, the paging root, and the memory types operate on the simulation, TLB invalidations are ignored.
+ * Works without ptedit_init, in which case only the simulation is available.
+ *
+ * @param[in] backing The file backing the physical memory, it is created or truncated (NULL for anonymous memory)
+ * @param[in] size The size of the simulated physical memory in bytes
+ *
+ * @return 0 Initialization was successful
+ * @return -1 Initialization failed or the simulation is already set up
+ */
+int ptedit_sim_init(const char* backing, size_t size);
+
+/**
+ * Releases the simulated MMU and switches back to the implementation that was used before. Called by ptedit_cleanup.
+ *
+ */
+void ptedit_sim_cleanup();
+
+/**
+ * Maps a 4 KB page in the simulated page tables, allocating page tables as required.
+ *
+ * @param[in] address The virtual address
+ * @param[in] pfn The page-frame number to map, or PTEDIT_SIM_ALLOC for a fresh frame
+ * @param[in] flags The page-table entry, the page-frame number in it is ignored
+ *
+ * @return 0 on success, -1 if the simulated memory is exhausted or a large page is in the way
+ */
+int ptedit_sim_map(void* address, size_t pfn, size_t flags);
+
+/**
+ * Builds synthetic page tables from the memory map of a process (/proc/pid/maps), each page is mapped to a fresh frame with
+ * permissions according to its mapping. Mappings that do not fit into the remaining simulated memory are skipped.
+ *
+ * @param[in] pid The pid of the process (0 for own process)
+ *
+ * @return The number of mapped pages, -1 on error
+ */
+ssize_t ptedit_sim_load_maps(pid_t pid);
+
+/**
+ * Captures the page-table layout of a process with the current implementation, e.g., the kernel module. Every present page is
+ * written as one line "vaddr pte" (hexadecimal), large pages are split into 4 KB pages.
+ *
+ * @param[in] pid The pid of the process (0 for own process)
+ * @param[in] path The file to write the layout to
+ *
+ * @return The number of captured pages, -1 on error
+ */
+ssize_t ptedit_sim_capture(pid_t pid, const char* path);
+
+/**
+ * Builds synthetic page tables from a layout captured with ptedit_sim_capture. The flags of the entries are kept, but every
+ * page is mapped to a fresh frame of the simulated memory.
+ *
+ * @param[in] path The layout file
+ *
+ * @return The number of mapped pages, -1 on error
+ */
+ssize_t ptedit_sim_load_layout(const char* path);
+
+/** @} */
+
+
+/**
+ * Record calls into a trace file, e.g., to replay them later against another implementation (see demos/replay.c)
+ *
+ * @defgroup TRACE Tracing
+ *
+ * @{
+ */
+
+/** Magic at the start of every trace file */
+#define PTEDIT_TRACE_MAGIC "PTEDTRC1"
+
+/** ptedit_resolve, arg is the address, the resolved entries follow the record */
+#define PTEDIT_TRACE_RESOLVE        0
+/** ptedit_update, arg is the address, the entries to write follow the record */
+#define PTEDIT_TRACE_UPDATE         1
+/** ptedit_read_physical_page, arg is the PFN */
+#define PTEDIT_TRACE_READ_PAGE      2
+/** ptedit_write_physical_page, arg is the PFN */
+#define PTEDIT_TRACE_WRITE_PAGE     3
+/** ptedit_get_paging_root, result is the root */
+#define PTEDIT_TRACE_GET_ROOT       4
+/** ptedit_set_paging_root, arg is the root */
+#define PTEDIT_TRACE_SET_ROOT       5
+/** ptedit_invalidate_tlb, arg is the address */
+#define PTEDIT_TRACE_INVALIDATE_TLB 6
+/** ptedit_get_mts, result is the value of all memory types */
+#define PTEDIT_TRACE_GET_MTS        7
+/** ptedit_set_mts, arg is the value of all memory types */
+#define PTEDIT_TRACE_SET_MTS        8
+/** ptedit_cmpxchg and the atomic bit operations, arg is the address, result the updated levels, the new entries or bits follow the record */
+#define PTEDIT_TRACE_ATOMIC         9
+
+/**
+ * Start of a trace file
+ */
+#pragma pack(push,1)
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pagesize;
+    /** Wall-clock time (ns since the epoch) when the trace was started */
+    uint64_t started;
+} ptedit_trace_header_t;
+#pragma pack(pop)
+
+/**
+ * One call, followed by one 64-bit entry for every bit in valid (PGD first, PTE last)
+ */
+#pragma pack(push,1)
+typedef struct {
+    uint8_t op;
+    uint8_t valid;
+    uint16_t reserved;
+    uint32_t pid;
+    /** Start of the call in ns since the trace was started */
+    uint64_t time;
+    /** Duration of the call in ns */
+    uint64_t duration;
+    uint64_t arg;
+    uint64_t result;
+} ptedit_trace_record_t;
+#pragma pack(pop)
+
+/**
+ * Starts recording all calls that read or modify page tables, physical memory, the paging root, the TLB, or the memory types.
+ * Convenience functions, e.g., ptedit_pte_set_bit, are recorded as the calls they consist of.
+ *
+ * @param[in] path The trace file, it is created or truncated
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int ptedit_trace_start(const char* path);
+
+/**
+ * Stops recording and closes the trace file. Called by ptedit_cleanup.
+ *
+ */
+void ptedit_trace_stop();
+
 /** @} */
 
 
@@ -442,6 +944,17 @@ void ptedit_set_paging_root(pid_t pid, size_t root);
   */
 void ptedit_invalidate_tlb(void* address);
 
+/**
+ * Selects how ptedit_invalidate_tlb invalidates the TLB, e.g., to benchmark the different strategies.
+ * The selection is reset to PTEDIT_TLB_STRATEGY_DEFAULT when the library is cleaned up.
+ *
+ * @param[in] strategy The invalidation strategy (one of PTEDIT_TLB_STRATEGY_*)
+ * @param[in] cpus Bit mask of the CPUs to invalidate on (0 for all online CPUs), ignored by PTEDIT_TLB_STRATEGY_FULL_MM
+ *
+ * @return 0 on success, -1 if the strategy is invalid or not supported by the CPU or kernel
+ */
+int ptedit_set_tlb_strategy(int strategy, size_t cpus);
+
 
 /**
  * A full serializing barrier which stops everything.
@@ -516,6 +1029,37 @@ unsigned char ptedit_find_mt(unsigned char type);
  */
 int ptedit_find_first_mt(unsigned char type);
 
+/**
+ * Reads the memory types again instead of using the cached value, e.g., if another process changed them.
+ * The library caches the memory types after the first read, such that looking up memory types does not require a syscall.
+ *
+ * @return The memory types in the same format as in the IA32_PAT MSR / MAIR_EL1
+ *
+ */
+size_t ptedit_mt_refresh();
+
+/**
+ * Returns a PAT/MAIR ID with the given memory type, reprogramming a free slot if no slot has this type yet.
+ * Only the upper four slots are reprogrammed if they are unused or duplicate a lower slot. Every successful call must be paired with ptedit_mt_release.
+ *
+ * @param[in] type A memory type, i.e., PAT/MAIR value (one of PTEDIT_MT_*)
+ *
+ * @return A PAT/MAIR ID, or -1 if no slot is available or it could not be reprogrammed
+ *
+ */
+int ptedit_mt_alloc(unsigned char type);
+
+/**
+ * Releases a PAT/MAIR ID returned by ptedit_mt_alloc. A reprogrammed slot gets its previous memory type back when it is released the last time.
+ * No page should use the slot anymore at this point.
+ *
+ * @param[in] mt The PAT/MAIR ID
+ *
+ * @return 0 on success, -1 if the slot was not allocated
+ *
+ */
+int ptedit_mt_release(int mt);
+
 /**
  * Returns a new page-table entry which uses the given memory type (PAT/MAIR).
  *
@@ -537,6 +1081,19 @@ size_t ptedit_apply_mt(size_t entry, unsigned char mt);
  */
 unsigned char ptedit_extract_mt(size_t entry);
 
+/**
+ * Changes the memory type (PAT/MAIR ID) of all pages in a virtual range, including huge pages overlapping the range.
+ * All entries are changed at once, followed by a single TLB invalidation and a write-back of the cached lines of the range.
+ *
+ * @param[in] address The virtual address of the range
+ * @param[in] length The length of the range in bytes
+ * @param[in] pid The process id (0 for own process)
+ * @param[in] mt A PAT/MAIR ID (between 0 and 7)
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int ptedit_set_mt_range(void* address, size_t length, pid_t pid, unsigned char mt);
+
 /**
  * Returns a human-readable representation of a memory type (PAT/MAIR value).
  *
@@ -1,6 +1,6 @@
 #include "utest.h"
 #include "../ptedit_header.h"
-#include <time.h>
+#include <sys/wait.h>
 
 UTEST_STATE();
 
@@ -10,6 +10,9 @@ UTEST_STATE();
 #define PAGE_ALIGN_CHAR __declspec(align(4096)) char
 #endif
 
+/* utest.h has no skipping, the test passes but reports why it did not run */
+#define SKIP(reason) do { printf("[  SKIPPED ] %s\n", reason); return; } while (0)
+
 PAGE_ALIGN_CHAR page1[4096];
 PAGE_ALIGN_CHAR page2[4096];
 PAGE_ALIGN_CHAR scratch[4096];
@@ -19,40 +22,6 @@ PAGE_ALIGN_CHAR accessor[4096];
 //                             Helper functions
 // =========================================================================
 
-#if defined(LINUX)
-size_t hrtime() {
-    struct timespec t1;
-    clock_gettime(CLOCK_MONOTONIC, &t1);
-    return t1.tv_sec * 1000 * 1000 * 1000ULL + t1.tv_nsec;
-}
-#else
-size_t hrtime() {
-    __int64 wintime; 
-    GetSystemTimePreciseAsFileTime((FILETIME*)&wintime);
-    return wintime;
-}
-#endif
-
-typedef void (*access_time_callback_t)(void*);
-
-int access_time_ext(void *ptr, size_t MEASUREMENTS, access_time_callback_t cb) {
-  size_t start = 0, end = 0, sum = 0;
-
-  for (int i = 0; i < MEASUREMENTS; i++) {
-    start = hrtime();
-    *((volatile size_t*)ptr);
-    end = hrtime();
-    sum += end - start;
-    if(cb) cb(ptr);
-  }
-
-  return (int)(10 * sum / MEASUREMENTS);
-}
-
-int access_time(void *ptr) {
-  return access_time_ext(ptr, 1000000, NULL);
-}
-
 int entry_equal(ptedit_entry_t* e1, ptedit_entry_t* e2) {
     int diff = 0;
     if((e1->valid & PTEDIT_VALID_MASK_PGD) && (e2->valid & PTEDIT_VALID_MASK_PGD)) {
@@ -72,6 +41,18 @@ int entry_equal(ptedit_entry_t* e1, ptedit_entry_t* e2) {
     }
     return !diff;
 }
+/* Walks a 4-level paging hierarchy by hand, returns the entry of the given level (3 is the PGD, 0 the PTE) */
+size_t walk_root(size_t root, void* address, int level) {
+    size_t table[4096 / sizeof(size_t)], entry = 0;
+    int i;
+    for (i = 3; i >= level; i--) {
+        ptedit_read_physical_page(root / 4096, (char*)table);
+        entry = table[((size_t)address >> (12 + 9 * i)) & 511];
+        root = ptedit_get_pfn(entry) * 4096;
+    }
+    return entry;
+}
+
 
 // =========================================================================
 //                             Resolving addresses
@@ -130,6 +111,10 @@ UTEST(resolve, resolve_page_offset) {
     ASSERT_TRUE(entry_equal(&vm1, &vm4));
 }
 
+UBENCH(resolve, resolve_speed) {
+    ptedit_resolve(scratch, 0);
+}
+
 
 // =========================================================================
 //                             Updating addresses
@@ -227,6 +212,129 @@ UTEST(pte, pte_set_pfn) {
     ASSERT_TRUE(accessor[0] == 2);
 }
 
+UTEST(pte, cmpxchg) {
+    ptedit_entry_t expected = ptedit_resolve(scratch, 0), desired = expected;
+    size_t pte = expected.pte, bit = 1ull << PTEDIT_PAGE_BIT_SOFTW1;
+    desired.pte |= bit;
+    desired.valid = PTEDIT_VALID_MASK_PTE;
+    ASSERT_EQ(ptedit_cmpxchg(scratch, 0, &expected, &desired), PTEDIT_VALID_MASK_PTE);
+    ASSERT_EQ(expected.pte, pte);
+    /* The entry changed, the swap fails and returns the current entry */
+    expected.pte = pte;
+    ASSERT_EQ(ptedit_cmpxchg(scratch, 0, &expected, &desired), 0);
+    ASSERT_EQ(expected.pte, desired.pte);
+    ASSERT_TRUE(ptedit_pte_fetch_andnot(scratch, 0, bit) & bit);
+    ASSERT_FALSE(ptedit_pte_fetch_or(scratch, 0, 0) & bit);
+}
+
+UTEST(pte, range_modify_bits) {
+    size_t i, pages = 16;
+    char* buffer = (char*)mmap(0, pages * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(buffer != MAP_FAILED);
+    memset(buffer, 1, pages * 4096);
+    ASSERT_EQ(ptedit_range_modify_bits(buffer, pages * 4096, 0, 1ull << PTEDIT_PAGE_BIT_SOFTW1, 1ull << PTEDIT_PAGE_BIT_RW), 0);
+    for (i = 0; i < pages; i++) {
+        ASSERT_TRUE(ptedit_pte_get_bit(buffer + i * 4096, 0, PTEDIT_PAGE_BIT_SOFTW1));
+        ASSERT_FALSE(ptedit_pte_get_bit(buffer + i * 4096, 0, PTEDIT_PAGE_BIT_RW));
+    }
+    ASSERT_EQ(ptedit_range_modify_bits(buffer, pages * 4096, 0, 1ull << PTEDIT_PAGE_BIT_RW, 1ull << PTEDIT_PAGE_BIT_SOFTW1), 0);
+    ASSERT_FALSE(ptedit_pte_get_bit(buffer, 0, PTEDIT_PAGE_BIT_SOFTW1));
+    buffer[0] = 2;
+    ASSERT_EQ(ptedit_range_modify_bits(buffer, 4096, 0, ptedit_set_pfn(0, 1), 0), -1);
+    munmap(buffer, pages * 4096);
+}
+
+UTEST(pte, alias_range) {
+    size_t i, pages = 16;
+    char* source = (char*)mmap(0, pages * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char* view = (char*)mmap(0, pages * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(source != MAP_FAILED);
+    ASSERT_TRUE(view != MAP_FAILED);
+    for (i = 0; i < pages; i++) memset(source + i * 4096, (int)i + 1, 4096);
+    ASSERT_EQ(ptedit_alias_range(view, source, pages * 4096, 0), 0);
+    for (i = 0; i < pages; i++) {
+        ASSERT_EQ(ptedit_pte_get_pfn(view + i * 4096, 0), ptedit_pte_get_pfn(source + i * 4096, 0));
+        ASSERT_EQ((int)view[i * 4096], (int)i + 1);
+    }
+    view[0] = 42;
+    ASSERT_EQ((int)source[0], 42);
+    /* The destination is populated now */
+    ASSERT_EQ(ptedit_alias_range(view, source, 4096, 0), -1);
+    munmap(view, pages * 4096);
+    ASSERT_EQ((int)source[4096], 2);
+    munmap(source, pages * 4096);
+}
+
+UTEST(pte, alias_range_all_or_nothing) {
+    size_t i, pages = 4;
+    char* source = (char*)mmap(0, pages * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char* view = (char*)mmap(0, pages * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(source != MAP_FAILED);
+    ASSERT_TRUE(view != MAP_FAILED);
+    /* The last source page is not present, so none of the others must stay aliased */
+    memset(source, 6, (pages - 1) * 4096);
+    ASSERT_EQ(ptedit_alias_range(view, source, pages * 4096, 0), -1);
+    for (i = 0; i < pages - 1; i++) {
+        ASSERT_FALSE(ptedit_resolve(view + i * 4096, 0).pte & 1);
+    }
+    view[0] = 7;
+    ASSERT_EQ((int)source[0], 6);
+    munmap(view, pages * 4096);
+    munmap(source, pages * 4096);
+}
+
+UTEST(pte, share_range) {
+    size_t pages = 16;
+    int ready[2], status = 0;
+    char shared = 0;
+    pid_t child;
+    char* source = (char*)mmap(0, pages * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    /* Reserved in both processes, but only populated by sharing */
+    char* view = (char*)mmap(0, pages * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(source != MAP_FAILED);
+    ASSERT_TRUE(view != MAP_FAILED);
+    /* The source stays writable (not copy-on-write) in this process */
+    madvise(source, pages * 4096, MADV_DONTFORK);
+    memset(source, 3, pages * 4096);
+    ASSERT_EQ(pipe(ready), 0);
+    child = fork();
+    if (!child) {
+        if (read(ready[0], &shared, 1) != 1 || !shared) _exit(1);
+        view[1] = 4;
+        _exit(view[0] == 3 && view[pages * 4096 - 1] == 3 ? 0 : 1);
+    }
+    ASSERT_TRUE(child > 0);
+    shared = ptedit_share_range(0, source, child, view, pages * 4096) == 0;
+    ASSERT_EQ(write(ready[1], &shared, 1), 1);
+    waitpid(child, &status, 0);
+    ASSERT_TRUE(shared);
+    ASSERT_TRUE(WIFEXITED(status) && !WEXITSTATUS(status));
+    ASSERT_EQ((int)source[1], 4);
+    close(ready[0]);
+    close(ready[1]);
+    munmap(view, pages * 4096);
+    munmap(source, pages * 4096);
+}
+
+UTEST(pte, share_range_all_or_nothing) {
+    size_t i, pages = 4;
+    char* source = (char*)mmap(0, pages * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char* view = (char*)mmap(0, pages * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(source != MAP_FAILED);
+    ASSERT_TRUE(view != MAP_FAILED);
+    memset(source, 5, pages * 4096);
+    /* The last page is populated, so none of the others must stay mapped */
+    view[(pages - 1) * 4096] = 1;
+    ASSERT_EQ(ptedit_share_range(0, source, 0, view, pages * 4096), -1);
+    for (i = 0; i < pages - 1; i++) {
+        ASSERT_FALSE(ptedit_resolve(view + i * 4096, 0).pte & 1);
+    }
+    ASSERT_EQ((int)view[0], 0);
+    munmap(view, pages * 4096);
+    ASSERT_EQ((int)source[0], 5);
+    munmap(source, pages * 4096);
+}
+
 
 // =========================================================================
 //                             Physical Pages
@@ -256,6 +364,226 @@ UTEST(page, write) {
     ASSERT_TRUE(!memcmp(page2, buffer, sizeof(buffer)));
 }
 
+UTEST(page, read_range) {
+    char buffer[4096];
+    size_t pfn = ptedit_pte_get_pfn(page2, 0);
+    ASSERT_TRUE(pfn);
+    ptedit_read_physical_range(pfn, buffer, sizeof(buffer));
+    ASSERT_TRUE(!memcmp(buffer, page2, sizeof(buffer)));
+}
+
+UTEST(page, write_range) {
+    char buffer[4096];
+    size_t pfn = ptedit_pte_get_pfn(scratch, 0);
+    ASSERT_TRUE(pfn);
+    memset(buffer, 0x3c, sizeof(buffer));
+    ptedit_write_physical_range(pfn, buffer, sizeof(buffer));
+    ASSERT_TRUE(!memcmp(buffer, scratch, sizeof(buffer)));
+    memset(scratch, 0, sizeof(scratch));
+}
+
+UTEST(page, range_huge) {
+    size_t size = 2 << 20, pfn, i;
+    char *mapping = (char*)mmap(0, 2 * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0), *huge, *buffer;
+    ptedit_entry_t vm;
+    ASSERT_TRUE(mapping != MAP_FAILED);
+    huge = (char*)(((size_t)mapping + size - 1) & ~(size - 1));
+    madvise(huge, size, MADV_HUGEPAGE);
+    for (i = 0; i < size; i += 4096) memset(huge + i, (int)(i >> 12), 4096);
+    vm = ptedit_resolve(huge, 0);
+    if (!(vm.valid & PTEDIT_VALID_MASK_PMD) || !(vm.pmd & (1ull << PTEDIT_PAGE_BIT_PSE))) {
+        munmap(mapping, 2 * size);
+        SKIP("no transparent huge page available");
+    }
+    pfn = ptedit_get_pfn(vm.pmd);
+    buffer = (char*)malloc(size);
+    ASSERT_TRUE(buffer != NULL);
+    /* The whole 2MB frame in a single call, the write is large enough to bypass the cache */
+    ptedit_read_physical_range(pfn, buffer, size);
+    ASSERT_TRUE(!memcmp(buffer, huge, size));
+    memset(buffer, 0x5a, size);
+    ptedit_write_physical_range(pfn, buffer, size);
+    ASSERT_TRUE(!memcmp(buffer, huge, size));
+    free(buffer);
+    munmap(mapping, 2 * size);
+}
+
+UTEST(page, read_multiple) {
+    char buffer1[4096], buffer2[4096];
+    size_t pfns[2] = { ptedit_pte_get_pfn(page1, 0), ptedit_pte_get_pfn(page2, 0) };
+    char* buffers[2] = { buffer1, buffer2 };
+    ASSERT_TRUE(pfns[0]);
+    ASSERT_TRUE(pfns[1]);
+    ptedit_read_physical_pages(pfns, buffers, 2);
+    ASSERT_TRUE(!memcmp(buffer1, page1, sizeof(buffer1)));
+    ASSERT_TRUE(!memcmp(buffer2, page2, sizeof(buffer2)));
+}
+
+UTEST(page, write_multiple) {
+    char buffer[4096];
+    size_t pfns[1] = { ptedit_pte_get_pfn(scratch, 0) };
+    char* contents[1] = { page2 };
+    ASSERT_TRUE(pfns[0]);
+    ptedit_write_physical_pages(pfns, contents, 1);
+    ptedit_read_physical_page(pfns[0], buffer);
+    ASSERT_TRUE(!memcmp(page2, buffer, sizeof(buffer)));
+    contents[0] = page1;
+    ptedit_write_physical_pages(pfns, contents, 1);
+    ptedit_read_physical_page(pfns[0], buffer);
+    ASSERT_TRUE(!memcmp(page1, buffer, sizeof(buffer)));
+}
+
+UTEST(page, pmap_window) {
+    size_t physical = ptedit_pte_get_pfn(page2, 0) * ptedit_get_pagesize();
+    char* first = (char*)ptedit_pmap(physical, 4096);
+    char* second = (char*)ptedit_pmap(physical + 8, 8);
+    ASSERT_TRUE(first != NULL);
+    ASSERT_TRUE(second == first + 8);
+    ASSERT_TRUE(!memcmp(first, page2, 4096));
+    ptedit_punmap(second, 8);
+    ptedit_punmap(first, 4096);
+}
+
+UTEST(page, map_range) {
+    size_t pfn = ptedit_pte_get_pfn(page2, 0);
+    char* target = (char*)mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(target != MAP_FAILED);
+    ASSERT_TRUE(pfn);
+    ASSERT_EQ(ptedit_map_range(target, pfn, 1, 0), 0);
+    ASSERT_EQ(ptedit_pte_get_pfn(target, 0), pfn);
+    ASSERT_TRUE(!memcmp(target, page2, 4096));
+    munmap(target, 4096);
+}
+
+UTEST(page, map_range_all_or_nothing) {
+    size_t pfn = ptedit_pte_get_pfn(page2, 0);
+    char* target = (char*)mmap(0, 2 * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(target != MAP_FAILED);
+    ASSERT_EQ(ptedit_map_range(target, pfn, 1, pfn << 12), -1);
+    /* The second page is populated, so the first one must not stay mapped */
+    target[4096] = 1;
+    ASSERT_EQ(ptedit_map_range(target, pfn, 2, 0), -1);
+    ASSERT_FALSE(ptedit_resolve(target, 0).pte & 1);
+    munmap(target, 2 * 4096);
+}
+
+// =========================================================================
+//                             Physical search
+// =========================================================================
+
+size_t search_target, search_calls, search_found;
+
+int search_until_target(size_t physical) {
+    search_calls++;
+    if (physical != search_target) return 0;
+    search_found = 1;
+    return 1;
+}
+
+int search_first(size_t physical) {
+    (void)physical;
+    search_calls++;
+    return 1;
+}
+
+UTEST(search, finds_page) {
+    char pattern[32];
+    size_t i;
+    char* page = (char*)mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    ASSERT_TRUE(page != MAP_FAILED);
+    srand((unsigned)time(NULL) ^ (unsigned)getpid());
+    for (i = 0; i < sizeof(pattern); i++) pattern[i] = (char)(rand() | 1);
+    memcpy(page + 128, pattern, sizeof(pattern));
+    search_target = ptedit_pte_get_pfn(page, 0) * ptedit_get_pagesize() + 128;
+    search_calls = search_found = 0;
+    ASSERT_TRUE(search_target != 128);
+    /* The pattern buffer itself matches as well, the callback stops at the planted copy */
+    ASSERT_GE(ptedit_phys_search(pattern, sizeof(pattern), search_until_target, 0), 1);
+    ASSERT_TRUE(search_found);
+    munmap(page, 4096);
+}
+
+UTEST(search, callback_stops) {
+    const char pattern[] = "PTEditor search stop";
+    search_calls = 0;
+    ASSERT_EQ(ptedit_phys_search(pattern, sizeof(pattern) - 1, search_first, 0), 1);
+    ASSERT_EQ(search_calls, 1u);
+}
+
+// =========================================================================
+//                             Reverse mapping
+// =========================================================================
+
+UTEST(rmap, lookup_own_page) {
+    const ptedit_rmap_entry_t* mappings;
+    size_t i, count, found = 0;
+    pid_t self = getpid();
+    size_t pfn = ptedit_pte_get_pfn(page1, 0);
+    ASSERT_TRUE(pfn);
+    ASSERT_EQ(ptedit_rmap_refresh(&self, 1), 0);
+    count = ptedit_rmap_lookup(pfn, &mappings);
+    for (i = 0; i < count; i++) {
+        if (mappings[i].pid == (size_t)self && mappings[i].vaddr == (size_t)page1) found = 1;
+    }
+    ASSERT_TRUE(found);
+    ptedit_rmap_free();
+}
+
+UTEST(rmap, lookup_invalid) {
+    ASSERT_EQ(ptedit_rmap_lookup(0x1234, NULL), 0u);
+}
+
+UTEST(rmap, query_own_page) {
+    ptedit_rmap_entry_t mappings[16];
+    size_t pfns[2] = { ptedit_pte_get_pfn(page1, 0), ptedit_pte_get_pfn(page2, 0) };
+    size_t found[2], i;
+    int own = 0;
+    if (ptedit_rmap_query(pfns, 2, 8, found, mappings)) {
+        ASSERT_EQ(errno, ENOSYS);
+        SKIP("rmap_walk is not available in this kernel");
+    }
+    ASSERT_LE(found[0], 8u);
+    ASSERT_LE(found[1], 8u);
+    for (i = 0; i < found[1]; i++) {
+        if (mappings[8 + i].pid == (size_t)getpid() && mappings[8 + i].vaddr == (size_t)page2) own = 1;
+    }
+    ASSERT_TRUE(own);
+}
+
+// =========================================================================
+//                             Asynchronous I/O
+// =========================================================================
+
+void async_done(void* context, int result) {
+    *(int*)context = result ? -1 : 1;
+}
+
+UTEST(async, resolve) {
+    ptedit_entry_t vm_async;
+    int done = 0;
+    if (ptedit_async_init(16)) SKIP("io_uring or physical memory file not available");
+    ASSERT_EQ(ptedit_async_resolve(page1, 0, &vm_async, async_done, &done), 0);
+    ptedit_async_wait(1);
+    ASSERT_EQ(done, 1);
+    ptedit_entry_t vm = ptedit_resolve(page1, 0);
+    ASSERT_TRUE(entry_equal(&vm, &vm_async));
+    ptedit_async_cleanup();
+}
+
+UTEST(async, read_pages) {
+    char buffer1[4096], buffer2[4096];
+    size_t pfns[2] = { ptedit_pte_get_pfn(page1, 0), ptedit_pte_get_pfn(page2, 0) };
+    char* buffers[2] = { buffer1, buffer2 };
+    int done = 0;
+    if (ptedit_async_init(16)) SKIP("io_uring or physical memory file not available");
+    ASSERT_EQ(ptedit_async_read_pages(pfns, buffers, 2, async_done, &done), 0);
+    ptedit_async_wait(1);
+    ASSERT_EQ(done, 1);
+    ASSERT_TRUE(!memcmp(buffer1, page1, sizeof(buffer1)));
+    ASSERT_TRUE(!memcmp(buffer2, page2, sizeof(buffer2)));
+    ptedit_async_cleanup();
+}
+
 // =========================================================================
 //                                Paging
 // =========================================================================
@@ -290,6 +618,27 @@ UTEST(paging, correct_root) {
     ptedit_entry_t vm = ptedit_resolve(0, 0);
     ASSERT_EQ(vm.pgd, buffer[0]);
 }
+UTEST(paging, clone_root) {
+    ptedit_entry_t vm = ptedit_resolve(page1, 0);
+    size_t root = ptedit_get_paging_root(0);
+    size_t clone = ptedit_clone_paging_root(0, page1, 4096, 0);
+    ASSERT_TRUE(clone);
+    ASSERT_NE(clone, root);
+    /* The page table is a copy with the same content */
+    ASSERT_NE(ptedit_get_pfn(walk_root(clone, page1, 1)), ptedit_get_pfn(vm.pmd));
+    ASSERT_EQ(walk_root(clone, page1, 0), vm.pte);
+    /* Destroying an installed clone restores the original root */
+    ptedit_set_paging_root(0, clone);
+    ASSERT_EQ(ptedit_get_paging_root(0), clone);
+    ASSERT_EQ(ptedit_destroy_paging_root(clone), 0);
+    ASSERT_EQ(ptedit_get_paging_root(0), root);
+
+    clone = ptedit_clone_paging_root(0, page1, 4096, PTEDIT_VALID_MASK_PTE);
+    ASSERT_TRUE(clone);
+    ASSERT_EQ(ptedit_get_pfn(walk_root(clone, page1, 1)), ptedit_get_pfn(vm.pmd));
+    ASSERT_EQ(ptedit_destroy_paging_root(clone), 0);
+}
+
 
 // =========================================================================
 //                               Memory Types
@@ -327,13 +676,35 @@ UTEST(memtype, extract) {
     ASSERT_TRUE(ptedit_extract_mt(ptedit_apply_mt((size_t)-1, 2)) == 2);
 }
 
+UTEST(memtype, set_mt_range) {
+    size_t i, pages = 16;
+    int uc_mt = ptedit_find_first_mt(PTEDIT_MT_UC);
+    ASSERT_NE(uc_mt, -1);
+    char* buffer = (char*)mmap(0, pages * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(buffer != MAP_FAILED);
+    memset(buffer, 3, pages * 4096);
+    int original = ptedit_extract_mt(ptedit_resolve(buffer, 0).pte);
+    ASSERT_EQ(ptedit_set_mt_range(buffer, pages * 4096, 0, uc_mt), 0);
+    for (i = 0; i < pages; i++) {
+        ASSERT_EQ((int)ptedit_extract_mt(ptedit_resolve(buffer + i * 4096, 0).pte), uc_mt);
+    }
+    /* Nothing may be lost by the cache maintenance */
+    ASSERT_EQ((int)buffer[pages * 4096 - 1], 3);
+    ASSERT_EQ(ptedit_set_mt_range(buffer, pages * 4096, 0, original), 0);
+    ASSERT_EQ((int)ptedit_extract_mt(ptedit_resolve(buffer, 0).pte), original);
+    munmap(buffer, pages * 4096);
+}
+
 UTEST(memtype, uncachable_access_time) {
+    struct utest_bench_s before, uc, after;
     int uc_mt = ptedit_find_first_mt(PTEDIT_MT_UC);
     ASSERT_NE(uc_mt, -1);
     int wb_mt = ptedit_find_first_mt(PTEDIT_MT_WB);
     ASSERT_NE(wb_mt, -1);
     
-    int before = access_time(scratch);
+    UBENCH_MEASURE(before) {
+        *((volatile size_t*)scratch);
+    }
     
     ptedit_entry_t entry = ptedit_resolve(scratch, 0);
     size_t pte = entry.pte;
@@ -343,16 +714,20 @@ UTEST(memtype, uncachable_access_time) {
     entry.valid = PTEDIT_VALID_MASK_PTE;
     ptedit_update(scratch, 0, &entry);   
     
-    int uc = access_time(scratch);
+    UBENCH_MEASURE(uc) {
+        *((volatile size_t*)scratch);
+    }
     
     entry.pte = pte;
     entry.valid = PTEDIT_VALID_MASK_PTE;
     ptedit_update(scratch, 0, &entry);   
     
-    int after = access_time(scratch);
+    UBENCH_MEASURE(after) {
+        *((volatile size_t*)scratch);
+    }
 
-    ASSERT_LT(after + 5, uc);
-    ASSERT_LT(before + 5, uc);
+    ASSERT_BENCH_LT(after, uc);
+    ASSERT_BENCH_LT(before, uc);
 }
 
 // =========================================================================
@@ -361,9 +736,115 @@ UTEST(memtype, uncachable_access_time) {
 
 
 UTEST(tlb, access_time) {
-    int flushed = access_time_ext(scratch, 100, ptedit_invalidate_tlb);
-    int normal = access_time_ext(scratch, 100, NULL);
-    ASSERT_GT(flushed, normal);
+    struct utest_bench_s flushed, normal;
+    UBENCH_MEASURE_EX(flushed, ptedit_invalidate_tlb(scratch)) {
+        *((volatile size_t*)scratch);
+    }
+    UBENCH_MEASURE(normal) {
+        *((volatile size_t*)scratch);
+    }
+    ASSERT_BENCH_GT(flushed, normal);
+}
+
+// =========================================================================
+//                             Simulated MMU
+// =========================================================================
+
+UTEST(sim, resolve_update) {
+    char buffer[4096], content[4096];
+    size_t flags = (1ull << PTEDIT_PAGE_BIT_PRESENT) | (1ull << PTEDIT_PAGE_BIT_RW) | (1ull << PTEDIT_PAGE_BIT_USER);
+    ASSERT_EQ(ptedit_sim_init(NULL, 1 << 20), 0);
+    ASSERT_EQ(ptedit_sim_map(page1, 100, flags), 0);
+    ptedit_entry_t vm = ptedit_resolve(page1, 0);
+    ASSERT_TRUE(vm.valid & PTEDIT_VALID_MASK_PTE);
+    ASSERT_EQ(ptedit_get_pfn(vm.pte), (size_t)100);
+    ASSERT_FALSE(ptedit_resolve(page2, 0).valid & PTEDIT_VALID_MASK_PTE);
+    memset(content, 0x5a, sizeof(content));
+    ptedit_write_physical_page(100, content);
+    ptedit_read_physical_page(100, buffer);
+    ASSERT_TRUE(!memcmp(buffer, content, sizeof(buffer)));
+    ptedit_pte_set_pfn(page1, 0, 101);
+    ASSERT_EQ(ptedit_pte_get_pfn(page1, 0), (size_t)101);
+    ASSERT_TRUE(ptedit_get_paging_root(0));
+    ptedit_sim_cleanup();
+    ASSERT_TRUE(ptedit_resolve(page1, 0).valid & PTEDIT_VALID_MASK_PTE);
+    ASSERT_NE(ptedit_pte_get_pfn(page1, 0), (size_t)101);
+}
+
+UTEST(sim, mt_alloc) {
+    ASSERT_EQ(ptedit_sim_init(NULL, 1 << 20), 0);
+    /* WB, WT, UC-, UC, WB, WT, UC-, UC */
+    ptedit_set_mts(0x0007040600070406ull);
+    ASSERT_EQ(ptedit_mt_alloc(PTEDIT_MT_WB), 0);
+    int wc = ptedit_mt_alloc(PTEDIT_MT_WC);
+    ASSERT_EQ(wc, 7);
+    ASSERT_TRUE(ptedit_get_mt(wc) == PTEDIT_MT_WC);
+    ASSERT_EQ(ptedit_mt_alloc(PTEDIT_MT_WC), wc);
+    ASSERT_EQ(ptedit_mt_alloc(PTEDIT_MT_WP), 6);
+    /* Slots 4 and 5 are the only remaining duplicates */
+    ASSERT_EQ(ptedit_mt_alloc(PTEDIT_MT_UCMINUS), 2);
+    ASSERT_EQ(ptedit_mt_release(wc), 0);
+    ASSERT_TRUE(ptedit_get_mt(wc) == PTEDIT_MT_WC);
+    ASSERT_EQ(ptedit_mt_release(wc), 0);
+    ASSERT_TRUE(ptedit_get_mt(wc) == PTEDIT_MT_UC);
+    ASSERT_EQ(ptedit_mt_release(wc), -1);
+    ASSERT_EQ(ptedit_mt_release(6), 0);
+    ASSERT_EQ(ptedit_mt_release(2), 0);
+    ASSERT_EQ(ptedit_mt_release(0), 0);
+    ASSERT_EQ(ptedit_get_mts(), (size_t)0x0007040600070406ull);
+    ptedit_sim_cleanup();
+}
+
+UTEST(sim, load_maps) {
+    ASSERT_EQ(ptedit_sim_init(NULL, 64 << 20), 0);
+    ASSERT_GT(ptedit_sim_load_maps(0), 0);
+    ASSERT_TRUE(ptedit_resolve(scratch, 0).valid & PTEDIT_VALID_MASK_PTE);
+    ASSERT_TRUE(ptedit_pte_get_bit(scratch, 0, PTEDIT_PAGE_BIT_RW));
+    ASSERT_FALSE(ptedit_resolve(0, 0).valid & PTEDIT_VALID_MASK_PTE);
+    ptedit_sim_cleanup();
+}
+
+// =========================================================================
+//                                Tracing
+// =========================================================================
+
+UTEST(trace, record) {
+    char path[] = "/tmp/ptedit-trace-XXXXXX", buffer[4096];
+    ptedit_trace_header_t header;
+    ptedit_trace_record_t record;
+    size_t entries[5];
+    int fd = mkstemp(path), ops[3] = {PTEDIT_TRACE_RESOLVE, PTEDIT_TRACE_UPDATE, PTEDIT_TRACE_READ_PAGE}, i;
+    ASSERT_GE(fd, 0);
+    close(fd);
+    ASSERT_EQ(ptedit_trace_start(path), 0);
+    ASSERT_EQ(ptedit_trace_start(path), -1);
+    ptedit_entry_t vm = ptedit_resolve(scratch, 0);
+    ptedit_update(scratch, 0, &vm);
+    ptedit_read_physical_page(ptedit_get_pfn(vm.pte), buffer);
+    ptedit_trace_stop();
+    /* Not recorded anymore */
+    ptedit_resolve(scratch, 0);
+
+    FILE* trace = fopen(path, "rb");
+    ASSERT_TRUE(trace);
+    ASSERT_EQ(fread(&header, sizeof(header), 1, trace), (size_t)1);
+    ASSERT_TRUE(!memcmp(header.magic, PTEDIT_TRACE_MAGIC, sizeof(header.magic)));
+    ASSERT_EQ(header.pagesize, (uint32_t)ptedit_get_pagesize());
+    for (i = 0; i < 3; i++) {
+        ASSERT_EQ(fread(&record, sizeof(record), 1, trace), (size_t)1);
+        ASSERT_EQ((int)record.op, (int)ops[i]);
+        ASSERT_EQ(fread(entries, sizeof(size_t), __builtin_popcount(record.valid), trace), (size_t)__builtin_popcount(record.valid));
+        if (i < 2) {
+            ASSERT_EQ(record.arg, (uint64_t)(size_t)scratch);
+            ASSERT_EQ((size_t)record.valid, vm.valid);
+            ASSERT_EQ(entries[__builtin_popcount(record.valid) - 1], vm.pte);
+        } else {
+            ASSERT_EQ(record.arg, (uint64_t)ptedit_get_pfn(vm.pte));
+        }
+    }
+    ASSERT_EQ(fread(&record, sizeof(record), 1, trace), (size_t)0);
+    fclose(trace);
+    unlink(path);
 }
 
 
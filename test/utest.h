@@ -198,16 +198,49 @@ static UTEST_INLINE utest_int64_t utest_ns(void) {
 
 typedef void (*utest_testcase_t)(int *, size_t);
 
+struct utest_bench_s {
+  char name[256];
+  utest_int64_t *samples;
+  size_t count;
+  size_t capacity;
+  size_t warmup;
+  size_t outliers;
+  utest_int64_t began;
+  utest_int64_t start;
+  utest_int64_t last;
+  double mean;
+  double m2;
+  double stddev;
+  double ci; /* half width of the 95% confidence interval of the mean */
+  utest_int64_t min;
+  utest_int64_t p50;
+  utest_int64_t p90;
+  utest_int64_t p99;
+  utest_int64_t max;
+};
+
+
 struct utest_test_state_s {
   utest_testcase_t func;
   size_t index;
   char *name;
 };
 
+struct utest_bench_baseline_s {
+  char name[256];
+  double mean;
+};
+
 struct utest_state_s {
   struct utest_test_state_s *tests;
   size_t tests_length;
   FILE *output;
+  const char *current;
+  struct utest_bench_baseline_s *baseline;
+  size_t baseline_length;
+  FILE *bench_record;
+  double bench_tolerance;
+  double bench_precision;
 };
 
 /* extern to the global state utest needs to execute */
@@ -664,6 +697,59 @@ utest_type_printer(long long unsigned int i) {
   void utest_run_##FIXTURE##_##NAME##_##INDEX(int *utest_result,               \
                                               struct FIXTURE *utest_fixture)
 
+/*
+   Benchmarks. UBENCH_MEASURE runs its body until the 95% confidence interval
+   of the mean execution time is within --bench-precision of the mean, or until
+   the sample or time budget is exhausted. Afterwards, the mean, standard
+   deviation and percentiles are reported, and the mean is compared against
+   the --bench-baseline file. A measurement that is slower than the baseline
+   by more than --bench-tolerance fails the test case. Runs that take more
+   than UTEST_BENCH_OUTLIER times the mean are discarded as outliers. PREPARE
+   is executed before every run of the body, but is not part of the measured
+   time. The body must not break out of the measurement.
+*/
+#define UBENCH_MEASURE_EX(BENCH, PREPARE)                                      \
+  for (utest_bench_init(&(BENCH), #BENCH);                                     \
+       ((void)(PREPARE), utest_bench_running(&(BENCH), utest_result));         \
+       utest_bench_sample(&(BENCH)))
+
+#define UBENCH_MEASURE(BENCH) UBENCH_MEASURE_EX(BENCH, 0)
+
+/* a test case that only measures its body, named after the test case */
+#define UBENCH(SET, NAME)                                                      \
+  static void ubench_run_##SET##_##NAME(void);                                 \
+  UTEST(SET, NAME) {                                                           \
+    struct utest_bench_s ubench;                                               \
+    for (utest_bench_init(&ubench, UTEST_NULL);                                \
+         utest_bench_running(&ubench, utest_result);                           \
+         utest_bench_sample(&ubench)) {                                        \
+      ubench_run_##SET##_##NAME();                                             \
+    }                                                                          \
+  }                                                                            \
+  static void ubench_run_##SET##_##NAME(void)
+
+/* x is faster than y if the confidence intervals do not overlap */
+#define UTEST_BENCH_FASTER(x, y) ((x).mean + (x).ci < (y).mean - (y).ci)
+
+#define EXPECT_BENCH_LT(x, y)                                                  \
+  if (!UTEST_BENCH_FASTER(x, y)) {                                             \
+    UTEST_PRINTF("%s:%u: Failure\n", __FILE__, __LINE__);                      \
+    UTEST_PRINTF("  Expected : %s (%.1fns +- %.1fns)\n", (x).name, (x).mean,   \
+                 (x).ci);                                                      \
+    UTEST_PRINTF("   Faster than %s (%.1fns +- %.1fns)\n", (y).name,          \
+                 (y).mean, (y).ci);                                            \
+    *utest_result = 1;                                                         \
+  }
+
+#define ASSERT_BENCH_LT(x, y)                                                  \
+  EXPECT_BENCH_LT(x, y);                                                       \
+  if (!UTEST_BENCH_FASTER(x, y)) {                                             \
+    return;                                                                    \
+  }
+
+#define EXPECT_BENCH_GT(x, y) EXPECT_BENCH_LT(y, x)
+#define ASSERT_BENCH_GT(x, y) ASSERT_BENCH_LT(y, x)
+
 UTEST_WEAK
 int utest_should_filter_test(const char *filter, const char *testcase);
 UTEST_WEAK int utest_should_filter_test(const char *filter,
@@ -760,6 +846,188 @@ static UTEST_INLINE FILE *utest_fopen(const char *filename, const char *mode) {
 #endif
 }
 
+#define UTEST_BENCH_WARMUP 16
+#define UTEST_BENCH_MIN_SAMPLES 64
+#define UTEST_BENCH_MAX_SAMPLES (1 << 20)
+#define UTEST_BENCH_OUTLIER 16
+#define UTEST_BENCH_BUDGET_NS (2 * 1000 * 1000 * 1000LL)
+#define UTEST_BENCH_TOLERANCE 10.0
+#define UTEST_BENCH_PRECISION 1.0
+
+static UTEST_INLINE double utest_bench_sqrt(double x) {
+  /* newton's method, to not require linking against libm */
+  double root = x > 1 ? x : 1;
+  int i;
+
+  if (x <= 0) {
+    return 0;
+  }
+  for (i = 0; i < 64; i++) {
+    root = 0.5 * (root + x / root);
+  }
+  return root;
+}
+
+static UTEST_INLINE int utest_bench_compare(const void *a, const void *b) {
+  const utest_int64_t x = *UTEST_PTR_CAST(const utest_int64_t *, a);
+  const utest_int64_t y = *UTEST_PTR_CAST(const utest_int64_t *, b);
+  return (x > y) - (x < y);
+}
+
+static UTEST_INLINE void utest_bench_init(struct utest_bench_s *bench,
+                                          const char *label) {
+  memset(bench, 0, sizeof(*bench));
+  if (label) {
+    UTEST_SNPRINTF(bench->name, sizeof(bench->name), "%s.%s",
+                   utest_state.current, label);
+  } else {
+    UTEST_SNPRINTF(bench->name, sizeof(bench->name), "%s",
+                   utest_state.current);
+  }
+  bench->began = utest_ns();
+}
+
+static UTEST_INLINE void utest_bench_sample(struct utest_bench_s *bench) {
+  const utest_int64_t end = utest_ns();
+  const double sample = UTEST_CAST(double, end - bench->start);
+  double delta;
+
+  bench->last = end;
+  if (bench->warmup < UTEST_BENCH_WARMUP) {
+    bench->warmup++;
+    return;
+  }
+  /* interrupts and preemption, they would dominate mean and variance */
+  if (bench->count >= UTEST_BENCH_MIN_SAMPLES &&
+      sample > UTEST_BENCH_OUTLIER * bench->mean) {
+    bench->outliers++;
+    return;
+  }
+  if (bench->count == bench->capacity) {
+    bench->capacity = bench->capacity ? bench->capacity * 2 : 1024;
+    bench->samples = UTEST_PTR_CAST(
+        utest_int64_t *,
+        realloc(UTEST_PTR_CAST(void *, bench->samples),
+                sizeof(utest_int64_t) * bench->capacity));
+  }
+  bench->samples[bench->count++] = end - bench->start;
+
+  /* welford's online algorithm, the stop condition needs it on every run */
+  delta = sample - bench->mean;
+  bench->mean += delta / UTEST_CAST(double, bench->count);
+  bench->m2 += delta * (sample - bench->mean);
+}
+
+static UTEST_INLINE const struct utest_bench_baseline_s *
+utest_bench_find_baseline(const char *name) {
+  size_t i;
+
+  for (i = 0; i < utest_state.baseline_length; i++) {
+    if (0 == strcmp(utest_state.baseline[i].name, name)) {
+      return &utest_state.baseline[i];
+    }
+  }
+  return UTEST_NULL;
+}
+
+static UTEST_INLINE void utest_bench_finish(struct utest_bench_s *bench,
+                                            int *utest_result) {
+  const struct utest_bench_baseline_s *baseline;
+  const double n = UTEST_CAST(double, bench->count);
+  const size_t last = bench->count - 1;
+
+  bench->stddev = utest_bench_sqrt(bench->m2 / (n - 1));
+  bench->ci = 1.96 * bench->stddev / utest_bench_sqrt(n);
+
+  qsort(bench->samples, bench->count, sizeof(utest_int64_t),
+        utest_bench_compare);
+  bench->min = bench->samples[0];
+  bench->p50 = bench->samples[last / 2];
+  bench->p90 = bench->samples[last * 90 / 100];
+  bench->p99 = bench->samples[last * 99 / 100];
+  bench->max = bench->samples[last];
+  free(UTEST_PTR_CAST(void *, bench->samples));
+  bench->samples = UTEST_NULL;
+
+  printf("[  BENCH   ] %s: mean %.1fns +- %.1fns, stddev %.1fns, "
+         "min %" UTEST_PRId64 "ns, p50 %" UTEST_PRId64 "ns, "
+         "p90 %" UTEST_PRId64 "ns, p99 %" UTEST_PRId64 "ns, "
+         "max %" UTEST_PRId64 "ns, %" UTEST_PRIu64 " samples, "
+         "%" UTEST_PRIu64 " outliers\n",
+         bench->name, bench->mean, bench->ci, bench->stddev, bench->min,
+         bench->p50, bench->p90, bench->p99, bench->max,
+         UTEST_CAST(utest_uint64_t, bench->count),
+         UTEST_CAST(utest_uint64_t, bench->outliers));
+
+  if (utest_state.bench_record) {
+    fprintf(utest_state.bench_record,
+            "%s %.3f %.3f %" UTEST_PRId64 " %" UTEST_PRId64 " %" UTEST_PRIu64
+            "\n",
+            bench->name, bench->mean, bench->stddev, bench->p50, bench->p99,
+            UTEST_CAST(utest_uint64_t, bench->count));
+  }
+
+  baseline = utest_bench_find_baseline(bench->name);
+  if (baseline && baseline->mean > 0) {
+    const double change =
+        100.0 * (bench->mean - baseline->mean) / baseline->mean;
+    printf("[  BENCH   ] %s: baseline %.1fns, %+.1f%%\n", bench->name,
+           baseline->mean, change);
+    /* only a regression if even the lower bound of the mean is too slow */
+    if (bench->mean - bench->ci >
+        baseline->mean * (1 + utest_state.bench_tolerance / 100)) {
+      UTEST_PRINTF("  Regression : %s is %.1f%% slower than the baseline "
+                   "(tolerance %.1f%%)\n",
+                   bench->name, change, utest_state.bench_tolerance);
+      *utest_result = 1;
+    }
+  }
+}
+
+static UTEST_INLINE int utest_bench_running(struct utest_bench_s *bench,
+                                           int *utest_result) {
+  if (bench->count >= UTEST_BENCH_MIN_SAMPLES) {
+    const double n = UTEST_CAST(double, bench->count);
+    const double variance = bench->m2 / (n - 1);
+    const double precision = utest_state.bench_precision / 100 * bench->mean;
+    /* compare the squares, no square root on every run */
+    const int converged = 1.96 * 1.96 * variance / n <= precision * precision;
+
+    if (converged || bench->count >= UTEST_BENCH_MAX_SAMPLES ||
+        bench->last - bench->began >= UTEST_BENCH_BUDGET_NS) {
+      utest_bench_finish(bench, utest_result);
+      return 0;
+    }
+  }
+  /* the timestamp is the last thing, nothing else ends up in the sample */
+  bench->start = utest_ns();
+  return 1;
+}
+
+static UTEST_INLINE int utest_bench_load_baseline(const char *filename) {
+  FILE *file = utest_fopen(filename, "r");
+  char line[512];
+
+  if (!file) {
+    return 1;
+  }
+  while (fgets(line, sizeof(line), file)) {
+    struct utest_bench_baseline_s entry;
+    if ('#' == line[0] || 2 != sscanf(line, "%255s %lf", entry.name,
+                                      &entry.mean)) {
+      continue;
+    }
+    utest_state.baseline = UTEST_PTR_CAST(
+        struct utest_bench_baseline_s *,
+        realloc(UTEST_PTR_CAST(void *, utest_state.baseline),
+                sizeof(struct utest_bench_baseline_s) *
+                    (utest_state.baseline_length + 1)));
+    utest_state.baseline[utest_state.baseline_length++] = entry;
+  }
+  fclose(file);
+  return 0;
+}
+
 UTEST_WEAK int utest_main(int argc, const char *const argv[]);
 UTEST_WEAK int utest_main(int argc, const char *const argv[]) {
   utest_uint64_t failed = 0;
@@ -778,6 +1046,9 @@ UTEST_WEAK int utest_main(int argc, const char *const argv[]) {
       colours[index] = "";
     }
   }
+  utest_state.bench_tolerance = UTEST_BENCH_TOLERANCE;
+  utest_state.bench_precision = UTEST_BENCH_PRECISION;
+
   /* loop through all arguments looking for our options */
   for (index = 1; index < UTEST_CAST(size_t, argc); index++) {
     /* Informational switches */
@@ -786,6 +1057,11 @@ UTEST_WEAK int utest_main(int argc, const char *const argv[]) {
     /* Test config switches */
     const char filter_str[] = "--filter=";
     const char output_str[] = "--output=";
+    /* Benchmark config switches */
+    const char baseline_str[] = "--bench-baseline=";
+    const char record_str[] = "--bench-record=";
+    const char tolerance_str[] = "--bench-tolerance=";
+    const char precision_str[] = "--bench-precision=";
 
     if (0 == utest_strncmp(argv[index], help_str, strlen(help_str))) {
       printf("utest.h - the single file unit testing solution for C/C++!\n"
@@ -796,7 +1072,15 @@ UTEST_WEAK int utest_main(int argc, const char *const argv[]) {
              "  --list-tests      List testnames, one per line. Output names "
              "can be passed to --filter.\n"
              "  --output=<output> Output an xunit XML file to the file "
-             "specified in <output>.\n");
+             "specified in <output>.\n"
+             "  --bench-baseline=<file>  Compare benchmarks against the "
+             "results in <file>.\n"
+             "  --bench-record=<file>    Write benchmark results to <file>, "
+             "usable as baseline.\n"
+             "  --bench-tolerance=<pct>  Allowed slowdown against the "
+             "baseline (default 10).\n"
+             "  --bench-precision=<pct>  Target width of the confidence "
+             "interval (default 1).\n");
       goto cleanup;
     } else if (0 ==
                utest_strncmp(argv[index], filter_str, strlen(filter_str))) {
@@ -805,6 +1089,24 @@ UTEST_WEAK int utest_main(int argc, const char *const argv[]) {
     } else if (0 ==
                utest_strncmp(argv[index], output_str, strlen(output_str))) {
       utest_state.output = utest_fopen(argv[index] + strlen(output_str), "w+");
+    } else if (0 ==
+               utest_strncmp(argv[index], baseline_str, strlen(baseline_str))) {
+      if (utest_bench_load_baseline(argv[index] + strlen(baseline_str))) {
+        printf("Could not read baseline file %s\n",
+               argv[index] + strlen(baseline_str));
+        failed = 1;
+        goto cleanup;
+      }
+    } else if (0 ==
+               utest_strncmp(argv[index], record_str, strlen(record_str))) {
+      utest_state.bench_record =
+          utest_fopen(argv[index] + strlen(record_str), "w");
+    } else if (0 == utest_strncmp(argv[index], tolerance_str,
+                                  strlen(tolerance_str))) {
+      utest_state.bench_tolerance = atof(argv[index] + strlen(tolerance_str));
+    } else if (0 == utest_strncmp(argv[index], precision_str,
+                                  strlen(precision_str))) {
+      utest_state.bench_precision = atof(argv[index] + strlen(precision_str));
     } else if (0 == utest_strncmp(argv[index], list_str, strlen(list_str))) {
       for (index = 0; index < utest_state.tests_length; index++) {
         UTEST_PRINTF("%s\n", utest_state.tests[index].name);
@@ -851,6 +1153,7 @@ UTEST_WEAK int utest_main(int argc, const char *const argv[]) {
               utest_state.tests[index].name);
     }
 
+    utest_state.current = utest_state.tests[index].name;
     ns = utest_ns();
     utest_state.tests[index].func(&result, utest_state.tests[index].index);
     ns = utest_ns() - ns;
@@ -900,10 +1203,16 @@ cleanup:
   free(UTEST_PTR_CAST(void *, failed_testcases));
   free(UTEST_PTR_CAST(void *, utest_state.tests));
 
+  free(UTEST_PTR_CAST(void *, utest_state.baseline));
+
   if (utest_state.output) {
     fclose(utest_state.output);
   }
 
+  if (utest_state.bench_record) {
+    fclose(utest_state.bench_record);
+  }
+
   return UTEST_CAST(int, failed);
 }
 
@@ -913,7 +1222,8 @@ cleanup:
    data without having to use the UTEST_MAIN macro, thus allowing them to write
    their own main() function.
 */
-#define UTEST_STATE() struct utest_state_s utest_state = {0, 0, 0}
+#define UTEST_STATE()                                                          \
+  struct utest_state_s utest_state = {0, 0, 0, 0, 0, 0, 0, 0, 0}
 
 /*
    define a main() function to call into utest.h and start executing tests! A